@@ -0,0 +1,257 @@
+// Microbenchmarks of the server's hot functions
+//
+//     artic-lsp-bench [--filter <substring>] [--json <file>] [--min-time <ms>]
+//                     [--workspace <folder> --file <source file>]
+//                     [--regressions <folder>]
+//                     [--startup <artic-lsp executable> [--runs <n>]]
+//
+// Without --workspace, runs on a synthetic project generated in a temporary folder.
+// With it, runs on a recorded project: the folder with its config and the file acting as the active file.
+// --regressions also compiles every .art file of the folder on its own, e.g. the inputs saved by artic-lsp-fuzz.
+// With --startup, measures the startup of the server process instead of single functions (see startup.h).
+// The compiler logs to stderr, run with 2>/dev/null for a clean table.
+
+#include "startup.h"
+#include "synthetic.h"
+
+#include "compile.h"
+#include "config.h"
+#include "language.h"
+#include "server.h"
+#include "visit.h"
+#include "workspace.h"
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+using namespace artic;
+using namespace artic::ls;
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+// Keep the compiler from optimizing away a result
+template <typename T>
+void keep(T&& value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+struct Result {
+    std::string name;
+    size_t iterations = 0;
+    // per iteration, over the batches
+    double mean_ns = 0, median_ns = 0, min_ns = 0;
+};
+
+struct Harness {
+    std::string filter;
+    std::chrono::milliseconds min_time{500};
+    std::vector<Result> results;
+
+    // Run f in batches, doubling the batch size until a batch takes a tenth of min_time
+    void run(const std::string& name, const std::function<void()>& f) {
+        if (name.find(filter) == std::string::npos) return;
+        f(); // warm up
+
+        std::vector<double> samples;
+        size_t batch = 1, iterations = 0;
+        auto total = clock_type::duration::zero();
+        while (total < min_time) {
+            auto start = clock_type::now();
+            for (size_t i = 0; i < batch; ++i) f();
+            auto elapsed = clock_type::now() - start;
+            total += elapsed;
+            iterations += batch;
+            samples.push_back(std::chrono::duration<double, std::nano>(elapsed).count() / batch);
+            if (elapsed < min_time / 10) batch *= 2;
+        }
+
+        Result res{ .name = name, .iterations = iterations };
+        res.mean_ns = std::chrono::duration<double, std::nano>(total).count() / iterations;
+        std::sort(samples.begin(), samples.end());
+        res.median_ns = samples[samples.size() / 2];
+        res.min_ns = samples.front();
+        std::printf("%-48s %12.0f ns %12.0f ns %12.0f ns %10zu\n", name.c_str(), res.mean_ns, res.median_ns, res.min_ns, iterations);
+        std::fflush(stdout);
+        results.push_back(std::move(res));
+    }
+};
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+    Harness harness;
+    std::string json_file;
+    fs::path workspace_folder, active_file, startup_server, regressions;
+    int startup_runs = 10;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                std::cerr << "missing value for " << arg << "\n";
+                std::exit(1);
+            }
+            return argv[++i];
+        };
+        if      (arg == "--filter")    harness.filter = value();
+        else if (arg == "--json")      json_file = value();
+        else if (arg == "--min-time")  harness.min_time = std::chrono::milliseconds(std::stoll(value()));
+        else if (arg == "--workspace") workspace_folder = value();
+        else if (arg == "--file")      active_file = value();
+        else if (arg == "--startup")   startup_server = value();
+        else if (arg == "--regressions") regressions = value();
+        else if (arg == "--runs")      startup_runs = std::max(1, std::stoi(value()));
+        else {
+            std::cerr << "usage: " << argv[0] << " [--filter <substring>] [--json <file>] [--min-time <ms>] [--workspace <folder> --file <source file>]"
+                         " [--regressions <folder>] [--startup <artic-lsp executable> [--runs <n>]]\n";
+            return 1;
+        }
+    }
+    if (workspace_folder.empty()) {
+        active_file = bench::write_synthetic_project(fs::temp_directory_path() / "artic-lsp-bench", 20, 50);
+        workspace_folder = active_file.parent_path().parent_path();
+    } else if (active_file.empty()) {
+        std::cerr << "--workspace needs --file\n";
+        return 1;
+    }
+    workspace_folder = fs::canonical(workspace_folder);
+    active_file = fs::canonical(active_file);
+    auto active = active_file.generic_string();
+
+    auto write_json = [&](const nlohmann::json& benchmarks, size_t num_files) {
+        if (json_file.empty()) return;
+        nlohmann::json out = {
+            {"context", {
+                {"date",      std::time(nullptr)},
+                {"workspace", workspace_folder.generic_string()},
+                {"file",      active},
+                {"files",     num_files},
+            }},
+            {"benchmarks", benchmarks},
+        };
+        std::ofstream(json_file) << out.dump(4) << "\n";
+    };
+
+    if (!startup_server.empty()) {
+        std::printf("%-48s %15s %15s %15s %10s\n", "stage (since exec)", "median", "min", "max", "runs");
+        try {
+            write_json(bench::run_startup(fs::canonical(startup_server), workspace_folder, active_file, startup_runs), 0);
+        } catch (const std::exception& e) {
+            std::cerr << "startup benchmark failed: " << e.what() << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    Server server;
+    server.workspace_ = std::make_unique<workspace::Workspace>(std::vector<fs::path>{ workspace_folder });
+    workspace::config::ConfigLog cfg_log;
+    server.workspace_->reload(cfg_log);
+    auto files = server.workspace_->collect_project_files(active_file, cfg_log);
+    std::sort(files.begin(), files.end(), [](const auto* a, const auto* b) { return a->path < b->path; });
+    std::printf("%s: %zu file(s)\n\n", workspace_folder.generic_string().c_str(), files.size());
+    std::printf("%-48s %15s %15s %15s %10s\n", "benchmark", "mean", "median", "min", "iterations");
+
+    // Workspace ---------------------------------------------------------------
+    harness.run("FilePatternParser::expand", [&] {
+        workspace::config::ConfigLog log;
+        keep(workspace::config::FilePatternParser::expand(workspace_folder, "**/*.art", log));
+    });
+    harness.run("Workspace::collect_project_files", [&] {
+        workspace::config::ConfigLog log;
+        keep(server.workspace_->collect_project_files(active_file, log));
+    });
+    harness.run("Workspace::collect_project_files (pruned)", [&] {
+        workspace::config::ConfigLog log;
+        keep(server.workspace_->collect_project_files(active_file, log, true));
+    });
+
+    // Compile -----------------------------------------------------------------
+    harness.run("Compiler::compile_files", [&] {
+        Compiler compiler;
+        compiler.compile_files(files, active_file);
+        keep(compiler.diagnostics);
+    });
+    if (!regressions.empty()) {
+        std::vector<fs::path> inputs;
+        for (const auto& entry : fs::directory_iterator(regressions)) {
+            if (entry.path().extension() == ".art") inputs.push_back(entry.path());
+        }
+        std::sort(inputs.begin(), inputs.end());
+        for (const auto& input : inputs) {
+            workspace::File file(fs::absolute(input));
+            file.read();
+            workspace::File* single[] = { &file };
+            harness.run("Compiler::compile_files (" + input.filename().string() + ")", [&] {
+                Compiler compiler;
+                compiler.compile_files(single, file.path);
+                keep(compiler.diagnostics);
+            });
+        }
+    }
+    server.compile = std::make_shared<Compiler>();
+    server.compile->compile_files(files, active_file);
+    harness.run("Compiler::flat_names", [&] {
+        FlatNameMap names;
+        names.build(server.compile->name_map);
+        keep(names);
+    });
+    const auto& names = server.compile->flat_names();
+
+    // Features ----------------------------------------------------------------
+    harness.run("collect (semantic tokens, full file)", [&] {
+        keep(collect(names, server.compile->lines(active), PositionEncoding::Utf16, active));
+    });
+    harness.run("collect (semantic tokens, 50 rows)", [&] {
+        keep(collect(names, server.compile->lines(active), PositionEncoding::Utf16, active, 100, 150));
+    });
+
+    std::vector<const ast::NamedDecl*> decls;
+    walk(server.compile->flat_tree(), *server.compile->program, [&](const ast::Node& node, size_t depth) {
+        if (auto decl = node.isa<ast::NamedDecl>()) decls.push_back(decl);
+        return depth < 1; // top-level declarations
+    });
+    harness.run("completion_item (all top-level declarations)", [&] {
+        for (auto decl : decls) keep(completion_item(*decl));
+    });
+
+    // A reference in the active file, so that the references of its declaration are collected
+    if (auto file_names = names.file_names(active)) {
+        auto path = std::make_shared<std::string>(active);
+        for (size_t i = 0; i < file_names->size(); ++i) {
+            if (file_names->is_decl[i]) continue;
+            const auto& span = file_names->spans[i];
+            Loc cursor(path, Loc::Pos{ .row = int(span.begin_row), .col = int(span.begin_col) });
+            harness.run("find_occurrences_of_identifier", [&] {
+                keep(find_occurrences_of_identifier(server, cursor, true));
+            });
+            break;
+        }
+    }
+
+    auto benchmarks = nlohmann::json::array();
+    for (const auto& res : harness.results) {
+        benchmarks.push_back({
+            {"name",       res.name},
+            {"iterations", res.iterations},
+            {"mean_ns",    res.mean_ns},
+            {"median_ns",  res.median_ns},
+            {"min_ns",     res.min_ns},
+        });
+    }
+    write_json(benchmarks, files.size());
+    return 0;
+}
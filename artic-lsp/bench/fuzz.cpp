@@ -0,0 +1,81 @@
+// Latency fuzzer: compiles mutated inputs and flags those that take too long or use too much memory
+//
+//     mkdir -p corpus && artic-lsp-fuzz -dict=bench/artic.dict corpus bench/regressions
+//
+// libFuzzer adds new inputs to the first corpus folder, bench/regressions only seeds it.
+// Built with clang and -D ARTIC_LS_BUILD_FUZZER=ON (libFuzzer). Thresholds and output are set by environment variables:
+//     ARTIC_FUZZ_MAX_MS    compile time per input (default 200)
+//     ARTIC_FUZZ_MAX_MB    heap held by the compile result (default 256)
+//     ARTIC_FUZZ_SAVE_DIR  where flagged inputs are written (default bench/regressions of the source tree), to be run by artic-lsp-bench --regressions
+//     ARTIC_FUZZ_ABORT     abort on the first flagged input, so that libFuzzer stops and minimizes it
+// Crashes and hangs are reported by libFuzzer itself (-timeout, -rss_limit_mb).
+
+#include "compile.h"
+#include "governor.h"
+#include "workspace.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <string_view>
+
+namespace fs = std::filesystem;
+using namespace artic::ls;
+
+namespace {
+
+struct Limits {
+    double max_ms = 200;
+    size_t max_bytes = size_t(256) << 20;
+    // set by CMake, so that the default does not depend on the working directory
+    fs::path save_dir = ARTIC_LS_FUZZ_SAVE_DIR;
+    bool abort = false;
+
+    Limits() {
+        if (auto v = std::getenv("ARTIC_FUZZ_MAX_MS"))   max_ms = std::atof(v);
+        if (auto v = std::getenv("ARTIC_FUZZ_MAX_MB"))   max_bytes = size_t(std::atoll(v)) << 20;
+        if (auto v = std::getenv("ARTIC_FUZZ_SAVE_DIR")) save_dir = v;
+        if (auto v = std::getenv("ARTIC_FUZZ_ABORT"))    abort = *v && *v != '0';
+    }
+};
+
+// Named after the hash of the input, so that finding it again overwrites instead of piling up
+void save(const Limits& limits, std::string_view cause, const std::string& text, double ms, size_t bytes) {
+    std::error_code ec;
+    fs::create_directories(limits.save_dir, ec);
+    auto name = std::string(cause) + "-" + std::to_string(std::hash<std::string>{}(text) & 0xffffffff) + ".art";
+    std::ofstream(limits.save_dir / name, std::ios::binary) << text;
+    std::fprintf(stderr, "artic-lsp-fuzz: %s: %.1f ms, %zu KB heap, saved as %s\n",
+        std::string(cause).c_str(), ms, bytes >> 10, (limits.save_dir / name).c_str());
+}
+
+} // anonymous namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    static const Limits limits;
+
+    workspace::File file(fs::path("/fuzz/input.art"));
+    file.text = std::string(reinterpret_cast<const char*>(data), size);
+    workspace::File* files[] = { &file };
+
+    auto heap_before = memory::heap_allocated_bytes();
+    auto start = std::chrono::steady_clock::now();
+    {
+        Compiler compiler;
+        compiler.compile_files(files, file.path);
+        auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        auto heap_after = memory::heap_allocated_bytes();
+        auto bytes = heap_after > heap_before ? heap_after - heap_before : 0;
+
+        bool slow = ms > limits.max_ms, large = bytes > limits.max_bytes;
+        if (slow)  save(limits, "slow",  *file.text, ms, bytes);
+        if (large) save(limits, "large", *file.text, ms, bytes);
+        if ((slow || large) && limits.abort) std::abort();
+    }
+    return 0;
+}
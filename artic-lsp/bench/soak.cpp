@@ -0,0 +1,371 @@
+// Soak test: runs the server in-process under sustained random load and reports latency percentiles and memory growth
+//
+//     artic-lsp-soak [--duration <s>] [--seed <n>] [--json <file>] [--slo-p99 <ms>]
+//                    [--workspace <folder> --file <source file>]
+//
+// The load is a random mix of edit bursts on the active file, completions, references, definitions
+// and config changes, sent back to back like an editor under a fast typist. Latency is measured
+// from sending a message to its response; for the notifications of an edit burst, to the response of
+// a request sent right after the burst. Exits with 1 if the p99 of any message kind exceeds --slo-p99.
+// Build with CMAKE_BUILD_TYPE=Debug for AddressSanitizer: leaks are reported when the process exits.
+
+#include "server.h"
+#include "synthetic.h"
+#include "governor.h"
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+using namespace artic::ls;
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+// Bytes flowing in one direction between the driver and the server
+class Pipe {
+public:
+    void write(const char* data, size_t size) {
+        std::lock_guard lock(mutex_);
+        buffer_.append(data, size);
+        cv_.notify_all();
+    }
+
+    // Blocks until size bytes are available, throws once closed
+    void read(char* data, size_t size) {
+        std::unique_lock lock(mutex_);
+        cv_.wait(lock, [&] { return buffer_.size() >= size || closed_; });
+        if (buffer_.size() < size) throw std::runtime_error("pipe closed");
+        std::copy_n(buffer_.data(), size, data);
+        buffer_.erase(0, size);
+    }
+
+    // Move everything available to out, waiting at most timeout for something to arrive
+    bool read_some(std::string& out, std::chrono::milliseconds timeout) {
+        std::unique_lock lock(mutex_);
+        if (!cv_.wait_for(lock, timeout, [&] { return !buffer_.empty() || closed_; }) || buffer_.empty()) return false;
+        out += buffer_;
+        buffer_.clear();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard lock(mutex_);
+        closed_ = true;
+        cv_.notify_all();
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::string buffer_;
+    bool closed_ = false;
+};
+
+// The server's end of the pipes
+class ServerStream : public lsp::io::Stream {
+public:
+    ServerStream(Pipe& in, Pipe& out) : in_(in), out_(out) {}
+    void read(char* buffer, std::size_t size) override { in_.read(buffer, size); }
+    void write(const char* buffer, std::size_t size) override { out_.write(buffer, size); }
+
+private:
+    Pipe& in_;
+    Pipe& out_;
+};
+
+// The driver's end: LSP framing and waiting for responses
+class Client {
+public:
+    Client(Pipe& to_server, Pipe& from_server) : to_server_(to_server), from_server_(from_server) {}
+
+    void notify(const std::string& method, nlohmann::json params) {
+        send({ {"jsonrpc", "2.0"}, {"method", method}, {"params", std::move(params)} });
+    }
+
+    nlohmann::json request(const std::string& method, nlohmann::json params = nullptr) {
+        auto id = ++last_id_;
+        nlohmann::json message = { {"jsonrpc", "2.0"}, {"id", id}, {"method", method} };
+        if (!params.is_null()) message["params"] = std::move(params);
+        send(message);
+        while (true) {
+            auto response = receive();
+            if (response.contains("id") && response["id"] == id && !response.contains("method")) return response;
+        }
+    }
+
+private:
+    void send(const nlohmann::json& message) {
+        auto body = message.dump();
+        auto data = "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+        to_server_.write(data.data(), data.size());
+    }
+
+    nlohmann::json receive() {
+        while (true) {
+            if (auto header_end = buffer_.find("\r\n\r\n"); header_end != std::string::npos) {
+                auto length_pos = buffer_.find("Content-Length:");
+                auto length = std::stoul(buffer_.substr(length_pos + 15, header_end - length_pos - 15));
+                auto body_begin = header_end + 4;
+                if (buffer_.size() >= body_begin + length) {
+                    auto message = nlohmann::json::parse(buffer_.substr(body_begin, length));
+                    buffer_.erase(0, body_begin + length);
+                    return message;
+                }
+            }
+            if (!from_server_.read_some(buffer_, std::chrono::minutes(5)))
+                throw std::runtime_error("server stopped responding");
+        }
+    }
+
+    Pipe& to_server_;
+    Pipe& from_server_;
+    std::string buffer_;
+    int last_id_ = 0;
+};
+
+std::string uri(const fs::path& path) { return "file://" + path.generic_string(); }
+
+std::vector<std::string> split_lines(const std::string& text) {
+    std::vector<std::string> lines;
+    std::stringstream stream(text);
+    for (std::string line; std::getline(stream, line);) lines.push_back(line);
+    if (lines.empty()) lines.emplace_back();
+    return lines;
+}
+
+std::string join_lines(const std::vector<std::string>& lines) {
+    std::string text;
+    for (const auto& line : lines) text += line + "\n";
+    return text;
+}
+
+double percentile(const std::vector<double>& sorted, double p) {
+    return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))];
+}
+
+struct MemorySample {
+    double seconds;
+    size_t resident, heap;
+};
+
+// Least squares slope of the samples after the warm up (first tenth), in bytes per hour
+double growth_per_hour(const std::vector<MemorySample>& samples, size_t MemorySample::*field) {
+    auto begin = samples.size() / 10;
+    if (samples.size() - begin < 2) return 0;
+    double n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (size_t i = begin; i < samples.size(); ++i) {
+        double x = samples[i].seconds, y = static_cast<double>(samples[i].*field);
+        n += 1; sx += x; sy += y; sxx += x * x; sxy += x * y;
+    }
+    auto denom = n * sxx - sx * sx;
+    return denom == 0 ? 0 : (n * sxy - sx * sy) / denom * 3600;
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+    std::chrono::seconds duration(60);
+    unsigned seed = std::random_device{}();
+    std::string json_file;
+    double slo_p99_ms = 0;
+    fs::path workspace_folder, active_file;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                std::cerr << "missing value for " << arg << "\n";
+                std::exit(1);
+            }
+            return argv[++i];
+        };
+        if      (arg == "--duration")  duration = std::chrono::seconds(std::stoll(value()));
+        else if (arg == "--seed")      seed = static_cast<unsigned>(std::stoul(value()));
+        else if (arg == "--json")      json_file = value();
+        else if (arg == "--slo-p99")   slo_p99_ms = std::stod(value());
+        else if (arg == "--workspace") workspace_folder = value();
+        else if (arg == "--file")      active_file = value();
+        else {
+            std::cerr << "usage: " << argv[0] << " [--duration <s>] [--seed <n>] [--json <file>] [--slo-p99 <ms>] [--workspace <folder> --file <source file>]\n";
+            return 1;
+        }
+    }
+    if (workspace_folder.empty()) {
+        active_file = bench::write_synthetic_project(fs::temp_directory_path() / "artic-lsp-soak", 10, 30);
+        workspace_folder = active_file.parent_path().parent_path();
+    } else if (active_file.empty()) {
+        std::cerr << "--workspace needs --file\n";
+        return 1;
+    }
+    workspace_folder = fs::canonical(workspace_folder);
+    active_file = fs::canonical(active_file);
+    auto config_file = workspace_folder / "artic.json";
+    std::printf("soak test of %s for %lld s, seed %u\n", active_file.generic_string().c_str(), static_cast<long long>(duration.count()), seed);
+
+    Pipe to_server, from_server;
+    ServerStream stream(to_server, from_server);
+    std::thread server_thread([&] {
+        Server server(stream);
+        server.run();
+        from_server.close();
+    });
+    Client client(to_server, from_server);
+
+    std::stringstream original;
+    original << std::ifstream(active_file).rdbuf();
+    const auto original_lines = split_lines(original.str());
+    auto lines = original_lines;
+    int version = 1;
+
+    client.request("initialize", {
+        {"processId", nullptr},
+        {"rootUri", uri(workspace_folder)},
+        {"workspaceFolders", {{ {"uri", uri(workspace_folder)}, {"name", workspace_folder.filename().string()} }}},
+        {"capabilities", nlohmann::json::object()},
+    });
+    client.notify("initialized", nlohmann::json::object());
+    client.notify("textDocument/didOpen", {{"textDocument", {
+        {"uri", uri(active_file)}, {"languageId", "artic"}, {"version", version}, {"text", join_lines(lines)},
+    }}});
+
+    std::mt19937 rng(seed);
+    auto random = [&](size_t n) { return std::uniform_int_distribution<size_t>(0, n - 1)(rng); };
+    auto random_position = [&]() -> nlohmann::json {
+        auto line = random(lines.size());
+        return { {"line", line}, {"character", random(lines[line].size() + 1)} };
+    };
+    // Typing mostly keeps the file parsing, but not always
+    const std::vector<std::string> snippets = {
+        "    let tmp = 1;", "    let t = f", "    if", "fn new_fn(x: i32) -> i32 { x }", "}", "    s.", "// comment", "struct",
+    };
+
+    std::map<std::string, std::vector<double>> latencies;
+    std::vector<MemorySample> memory;
+    const auto start = clock_type::now();
+    auto next_sample = start, next_report = start + std::chrono::minutes(1);
+    size_t messages = 0;
+
+    auto timed = [&](const std::string& kind, auto&& f) {
+        auto begin = clock_type::now();
+        f();
+        latencies[kind].push_back(std::chrono::duration<double, std::milli>(clock_type::now() - begin).count());
+    };
+
+    while (clock_type::now() - start < duration) {
+        auto roll = random(100);
+        if (roll < 40) {
+            // Burst of edits, as the client sends them while typing
+            timed("edit burst", [&] {
+                auto edits = 1 + random(8);
+                for (size_t i = 0; i < edits; ++i) {
+                    if (random(20) == 0) {
+                        lines = original_lines;
+                    } else if (random(3) == 0 && lines.size() > 1) {
+                        lines.erase(lines.begin() + random(lines.size()));
+                    } else {
+                        lines.insert(lines.begin() + random(lines.size() + 1), snippets[random(snippets.size())]);
+                    }
+                    client.notify("textDocument/didChange", {
+                        {"textDocument", { {"uri", uri(active_file)}, {"version", ++version} }},
+                        {"contentChanges", {{ {"text", join_lines(lines)} }}},
+                    });
+                    ++messages;
+                }
+                // messages are handled in order: this responds after the last edit was compiled
+                client.request("artic/stats");
+            });
+        } else if (roll < 65) {
+            timed("completion", [&] {
+                client.request("textDocument/completion", { {"textDocument", {{"uri", uri(active_file)}}}, {"position", random_position()} });
+            });
+        } else if (roll < 85) {
+            timed("references", [&] {
+                client.request("textDocument/references", {
+                    {"textDocument", {{"uri", uri(active_file)}}}, {"position", random_position()}, {"context", {{"includeDeclaration", true}}},
+                });
+            });
+        } else if (roll < 97) {
+            timed("definition", [&] {
+                client.request("textDocument/definition", { {"textDocument", {{"uri", uri(active_file)}}}, {"position", random_position()} });
+            });
+        } else {
+            // Rewrite the config unchanged, the server still reloads it
+            timed("config change", [&] {
+                std::stringstream config;
+                config << std::ifstream(config_file).rdbuf();
+                std::ofstream(config_file) << config.str();
+                client.notify("textDocument/didSave", {{"textDocument", {{"uri", uri(config_file)}}}});
+                client.request("artic/stats");
+            });
+        }
+        ++messages;
+
+        auto now = clock_type::now();
+        if (now >= next_sample) {
+            memory.push_back({ std::chrono::duration<double>(now - start).count(), memory::resident_bytes(), memory::heap_allocated_bytes() });
+            next_sample = now + std::chrono::seconds(1);
+        }
+        if (now >= next_report) {
+            std::printf("%6.0f s: %zu messages, %zu MB resident, %zu MB heap\n",
+                std::chrono::duration<double>(now - start).count(), messages, memory.back().resident >> 20, memory.back().heap >> 20);
+            std::fflush(stdout);
+            next_report = now + std::chrono::minutes(1);
+        }
+    }
+
+    // the server stops after the shutdown request
+    client.request("shutdown");
+    to_server.close();
+    server_thread.join();
+
+    // Report
+    bool slo_met = true;
+    auto results = nlohmann::json::array();
+    std::printf("\n%-16s %8s %10s %10s %10s %10s %10s\n", "message", "count", "p50", "p90", "p99", "p99.9", "max");
+    for (auto& [kind, times] : latencies) {
+        std::sort(times.begin(), times.end());
+        auto p99 = percentile(times, 0.99);
+        std::printf("%-16s %8zu %8.1fms %8.1fms %8.1fms %8.1fms %8.1fms\n", kind.c_str(), times.size(),
+            percentile(times, 0.5), percentile(times, 0.9), p99, percentile(times, 0.999), times.back());
+        if (slo_p99_ms > 0 && p99 > slo_p99_ms) slo_met = false;
+        results.push_back({
+            {"name", kind}, {"count", times.size()},
+            {"p50_ms", percentile(times, 0.5)}, {"p90_ms", percentile(times, 0.9)}, {"p99_ms", p99},
+            {"p999_ms", percentile(times, 0.999)}, {"max_ms", times.back()},
+        });
+    }
+    auto resident_growth = growth_per_hour(memory, &MemorySample::resident);
+    auto heap_growth = growth_per_hour(memory, &MemorySample::heap);
+    std::printf("\nmemory growth after warm up: %.1f MB/h resident, %.1f MB/h heap\n", resident_growth / (1 << 20), heap_growth / (1 << 20));
+    if (slo_p99_ms > 0) std::printf("p99 SLO of %.1f ms %s\n", slo_p99_ms, slo_met ? "met" : "MISSED");
+
+    if (!json_file.empty()) {
+        nlohmann::json out = {
+            {"context", { {"file", active_file.generic_string()}, {"duration_s", duration.count()}, {"seed", seed}, {"messages", messages} }},
+            {"latency", results},
+            {"memory", {
+                {"resident_growth_bytes_per_hour", resident_growth},
+                {"heap_growth_bytes_per_hour", heap_growth},
+                {"final_resident_bytes", memory.empty() ? 0 : memory.back().resident},
+                {"final_heap_bytes", memory.empty() ? 0 : memory.back().heap},
+            }},
+        };
+        std::ofstream(json_file) << out.dump(4) << "\n";
+    }
+    return slo_met ? 0 : 1;
+}
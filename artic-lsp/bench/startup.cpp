@@ -0,0 +1,188 @@
+#include "startup.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace artic::ls::bench {
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+// Server process spoken to over its stdin and stdout, as an editor does
+class ServerProcess {
+public:
+    explicit ServerProcess(const fs::path& server) {
+        int to_server[2], from_server[2];
+        if (pipe(to_server) < 0 || pipe(from_server) < 0) throw std::runtime_error("pipe failed");
+        pid_ = fork();
+        if (pid_ < 0) throw std::runtime_error("fork failed");
+        if (pid_ == 0) {
+            dup2(to_server[0], STDIN_FILENO);
+            dup2(from_server[1], STDOUT_FILENO);
+            int null = open("/dev/null", O_WRONLY);
+            dup2(null, STDERR_FILENO);
+            close(to_server[1]);
+            close(from_server[0]);
+            execl(server.c_str(), server.c_str(), static_cast<char*>(nullptr));
+            _exit(127);
+        }
+        close(to_server[0]);
+        close(from_server[1]);
+        in_ = to_server[1];
+        out_ = from_server[0];
+    }
+
+    ~ServerProcess() {
+        close(in_);
+        close(out_);
+        int status;
+        waitpid(pid_, &status, 0);
+    }
+
+    void send(const nlohmann::json& message) {
+        auto body = message.dump();
+        auto data = "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+        for (size_t written = 0; written < data.size();) {
+            auto n = write(in_, data.data() + written, data.size() - written);
+            if (n <= 0) throw std::runtime_error("server closed its input");
+            written += n;
+        }
+    }
+
+    // Next message of the server, throws after timeout
+    nlohmann::json receive(std::chrono::milliseconds timeout = std::chrono::seconds(60)) {
+        while (true) {
+            if (auto header_end = buffer_.find("\r\n\r\n"); header_end != std::string::npos) {
+                auto length_pos = buffer_.find("Content-Length:");
+                if (length_pos == std::string::npos || length_pos > header_end) throw std::runtime_error("missing Content-Length");
+                auto length = std::stoul(buffer_.substr(length_pos + 15, header_end - length_pos - 15));
+                auto body_begin = header_end + 4;
+                if (buffer_.size() >= body_begin + length) {
+                    auto message = nlohmann::json::parse(buffer_.substr(body_begin, length));
+                    buffer_.erase(0, body_begin + length);
+                    return message;
+                }
+            }
+            pollfd fd{ .fd = out_, .events = POLLIN };
+            if (poll(&fd, 1, static_cast<int>(timeout.count())) <= 0) throw std::runtime_error("server did not respond in time");
+            char chunk[65536];
+            auto n = read(out_, chunk, sizeof(chunk));
+            if (n <= 0) throw std::runtime_error("server exited");
+            buffer_.append(chunk, n);
+        }
+    }
+
+    // Skip messages until one matches
+    template <typename F>
+    nlohmann::json receive_until(F&& matches) {
+        while (true) {
+            auto message = receive();
+            if (matches(message)) return message;
+        }
+    }
+
+private:
+    pid_t pid_;
+    int in_, out_;
+    std::string buffer_;
+};
+
+std::string uri(const fs::path& path) { return "file://" + path.generic_string(); }
+
+double ms_since(clock_type::time_point start) {
+    return std::chrono::duration<double, std::milli>(clock_type::now() - start).count();
+}
+
+} // anonymous namespace
+
+nlohmann::json run_startup(const fs::path& server, const fs::path& workspace_folder, const fs::path& file, int runs) {
+    std::stringstream text;
+    text << std::ifstream(file).rdbuf();
+
+    // stage -> times of all runs in ms
+    std::map<std::string, std::vector<double>> stages;
+    std::vector<std::string> order;
+    auto record = [&](const std::string& stage, double ms) {
+        if (!stages.contains(stage)) order.push_back(stage);
+        stages[stage].push_back(ms);
+    };
+
+    for (int run = 0; run < runs; ++run) {
+        auto start = clock_type::now();
+        ServerProcess process(server);
+
+        process.send({
+            {"jsonrpc", "2.0"}, {"id", 1}, {"method", "initialize"},
+            {"params", {
+                {"processId", getpid()},
+                {"rootUri", uri(workspace_folder)},
+                {"workspaceFolders", {{ {"uri", uri(workspace_folder)}, {"name", workspace_folder.filename().string()} }}},
+                {"capabilities", nlohmann::json::object()},
+            }},
+        });
+        process.receive_until([](const auto& m) { return m.contains("id") && m["id"] == 1; });
+        record("client: initialize response", ms_since(start));
+
+        process.send({ {"jsonrpc", "2.0"}, {"method", "initialized"}, {"params", nlohmann::json::object()} });
+        process.send({
+            {"jsonrpc", "2.0"}, {"method", "textDocument/didOpen"},
+            {"params", {{"textDocument", {
+                {"uri", uri(file)}, {"languageId", "artic"}, {"version", 1}, {"text", text.str()},
+            }}}},
+        });
+        process.receive_until([&](const auto& m) {
+            return m.value("method", "") == "textDocument/publishDiagnostics" && m["params"]["uri"] == uri(file);
+        });
+        record("client: first diagnostics", ms_since(start));
+
+        // the stages inside the server, measured from its static initialization
+        process.send({ {"jsonrpc", "2.0"}, {"id", 2}, {"method", "artic/stats"} });
+        auto stats = process.receive_until([](const auto& m) { return m.contains("id") && m["id"] == 2; });
+        auto startup = nlohmann::json::parse(stats["result"].template get<std::string>()).value("startup", nlohmann::json::object());
+        for (const auto& [stage, ms] : startup.items()) record("server: " + stage, ms.template get<double>());
+
+        process.send({ {"jsonrpc", "2.0"}, {"id", 3}, {"method", "shutdown"} });
+        process.receive_until([](const auto& m) { return m.contains("id") && m["id"] == 3; });
+        process.send({ {"jsonrpc", "2.0"}, {"method", "exit"} });
+    }
+
+    auto median = [&](const std::string& stage) {
+        auto& times = stages[stage];
+        std::sort(times.begin(), times.end());
+        return times[times.size() / 2];
+    };
+    // as a timeline
+    std::sort(order.begin(), order.end(), [&](const auto& a, const auto& b) { return median(a) < median(b); });
+
+    auto results = nlohmann::json::array();
+    for (const auto& stage : order) {
+        const auto& times = stages[stage];
+        auto mid = times[times.size() / 2];
+        std::printf("%-48s %12.1f ms %12.1f ms %12.1f ms %10zu\n", stage.c_str(), mid, times.front(), times.back(), times.size());
+        results.push_back({
+            {"name",      "startup/" + stage},
+            {"runs",      times.size()},
+            {"median_ms", mid},
+            {"min_ms",    times.front()},
+            {"max_ms",    times.back()},
+        });
+    }
+    return results;
+}
+
+} // namespace artic::ls::bench
@@ -0,0 +1,17 @@
+#ifndef ARTIC_LS_BENCH_STARTUP_H
+#define ARTIC_LS_BENCH_STARTUP_H
+
+#include <nlohmann/json.hpp>
+
+#include <filesystem>
+
+namespace artic::ls::bench {
+
+// Start the server runs times and measure its startup stages as seen by a client:
+// from exec to the Initialize response and to the first diagnostics of the opened file.
+// Prints the median of every stage and returns them as benchmark results (see bench.cpp).
+nlohmann::json run_startup(const std::filesystem::path& server, const std::filesystem::path& workspace_folder, const std::filesystem::path& file, int runs);
+
+} // namespace artic::ls::bench
+
+#endif // ARTIC_LS_BENCH_STARTUP_H
@@ -0,0 +1,36 @@
+#include "synthetic.h"
+
+#include <fstream>
+#include <string>
+
+namespace fs = std::filesystem;
+
+namespace artic::ls::bench {
+
+fs::path write_synthetic_project(const fs::path& root, size_t num_files, size_t decls_per_file) {
+    fs::remove_all(root);
+    fs::create_directories(root / "src");
+    std::ofstream(root / "artic.json") << R"({
+    "artic-config": "2.0",
+    "projects": [ { "name": "bench", "files": [ "src/**/*.art" ] } ]
+})";
+
+    for (size_t i = 0; i < num_files; ++i) {
+        std::ofstream out(root / "src" / ("file" + std::to_string(i) + ".art"));
+        for (size_t j = 0; j < decls_per_file; ++j) {
+            auto id = std::to_string(i) + "_" + std::to_string(j);
+            auto prev = i > 0 ? std::to_string(i - 1) + "_" + std::to_string(j) : id;
+            out << "struct S" << id << " { x: i32, y: f32 }\n"
+                << "static K" << id << ": i32 = " << j << ";\n"
+                << "// calls into the previous file\n"
+                << "fn f" << id << "(a: i32, b: i32) -> i32 {\n"
+                << "    let s = S" << id << " { x = a, y = 1.0f };\n"
+                << "    let c = s.x + b * K" << id << ";\n"
+                << "    if c > 100 { f" << prev << "(c - 1, b) } else { c }\n"
+                << "}\n\n";
+        }
+    }
+    return root / "src" / ("file" + std::to_string(num_files - 1) + ".art");
+}
+
+} // namespace artic::ls::bench
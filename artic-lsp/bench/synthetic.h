@@ -0,0 +1,15 @@
+#ifndef ARTIC_LS_BENCH_SYNTHETIC_H
+#define ARTIC_LS_BENCH_SYNTHETIC_H
+
+#include <cstddef>
+#include <filesystem>
+
+namespace artic::ls::bench {
+
+// (Re)create a project in root: an artic.json and num_files files with structs, statics
+// and functions, each file calling into the previous one. Returns the path of the last file.
+std::filesystem::path write_synthetic_project(const std::filesystem::path& root, size_t num_files, size_t decls_per_file);
+
+} // namespace artic::ls::bench
+
+#endif // ARTIC_LS_BENCH_SYNTHETIC_H
@@ -56,6 +56,20 @@ FetchContent_Declare(
 )
 FetchContent_MakeAvailable(lsp)
 
+# mimalloc (ARTIC_LS_ALLOCATOR=mimalloc)
+if(ARTIC_LS_ALLOCATOR STREQUAL "mimalloc")
+    set(MI_OVERRIDE ON CACHE BOOL "" FORCE)
+    set(MI_BUILD_SHARED OFF CACHE BOOL "" FORCE)
+    set(MI_BUILD_OBJECT OFF CACHE BOOL "" FORCE)
+    set(MI_BUILD_TESTS OFF CACHE BOOL "" FORCE)
+    FetchContent_Declare(
+        mimalloc
+        GIT_REPOSITORY https://github.com/microsoft/mimalloc.git
+        GIT_TAG v2.1.7
+    )
+    FetchContent_MakeAvailable(mimalloc)
+endif()
+
 # nlohmann_json
 FetchContent_Declare(
     nlohmann_json
@@ -0,0 +1,24 @@
+#ifndef ARTIC_LS_CHECK_H
+#define ARTIC_LS_CHECK_H
+
+#include <filesystem>
+#include <string>
+
+namespace artic::ls::check {
+
+struct Options {
+    // workspace folder, or a config file in it
+    std::filesystem::path workspace;
+    // parallel compiles, 0 for one per core
+    unsigned jobs = 0;
+    // write the diagnostics as JSON to this file ("-" for stdout) instead of as text
+    std::string json_file;
+};
+
+// Headless check of a whole workspace (artic-lsp --check): compiles every project in parallel
+// and reports the diagnostics. Returns the exit status: 0 without errors, 1 with errors, 2 if there was nothing to check.
+int run(const Options& options);
+
+} // namespace artic::ls::check
+
+#endif // ARTIC_LS_CHECK_H
@@ -8,10 +8,26 @@
 #include "artic/check.h"
 #include "artic/locator.h"
 #include "artic/log.h"
+#include "lines.h"
+#include "namemap.h"
+#include "stats.h"
+#include "visit.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <span>
 
 namespace artic::ls{
 
+// Phases of a compile, in order
+enum class Phase : uint8_t { Parse, Bind, Check, Summon, Done };
+
+std::string_view phase_name(Phase phase);
+
 struct Compiler {
     Compiler()
         : arena(), type_table(), locator()
@@ -26,10 +42,43 @@ struct Compiler {
             name_binder.warn_on_shadowing = true;
     }
 
-    void compile_files(std::span<workspace::File*> files, std::filesystem::path active_file);
+    void compile_files(std::span<workspace::File*> files, std::filesystem::path active_file) {
+        parse_and_bind(files, active_file);
+        check();
+    }
+    void parse_and_bind(std::span<workspace::File*> files, std::filesystem::path active_file);
+    // Type checking and summoning up to last_phase
+    void check();
+
+    // Progress, readable from other threads while a phase runs
+    std::atomic<Phase> phase = Phase::Parse;
+    // steady_clock ticks at the start of the current phase
+    std::atomic<int64_t> phase_started = 0;
+    // also receives every phase entered, e.g. a word shared with the process watching a worker compile
+    std::atomic<uint64_t>* phase_progress = nullptr;
 
     // Output -----
     NameMap name_map;
+    // Declarations substituted from the last parsed text of a file, by the file name they were compiled under
+    Relocations relocations;
+    // Flat copy of name_map for lookups, built on first use
+    const FlatNameMap& flat_names() {
+        if (!flat_names_built_) {
+            flat_names_.build(name_map, relocations);
+            flat_names_built_ = true;
+        }
+        return flat_names_;
+    }
+    // Pre-order nodes of program for walk(), built on first use
+    const FlatTree& flat_tree() {
+        if (!flat_tree_built_) {
+            if (program) flat_tree_ = FlatTree(*program);
+            flat_tree_built_ = true;
+        }
+        return flat_tree_;
+    }
+    // Column conversion for a compiled text, built on first use (from any thread), nullptr if file was not compiled
+    const LineIndex* lines(const std::string& file) const;
     std::vector<Diagnostic> diagnostics;
     Ptr<ast::ModDecl> program;
     bool parsed_all;
@@ -37,6 +86,15 @@ struct Compiler {
     // Input -----
     bool exclude_non_parsed_files = false;
     std::filesystem::path active_file;
+    // only the files reachable from active_file were compiled
+    bool pruned = false;
+    // skip the phases after it: Phase::Bind under memory pressure, or after a phase exceeded its time budget
+    Phase last_phase = Phase::Summon;
+    // time budget of each phase from Phase::Check on, 0 for none: a running phase cannot be
+    // interrupted, once one exceeds it the phases after it are skipped (last_phase is lowered)
+    std::chrono::milliseconds phase_budget{0};
+    // phase that exceeded its time budget, Done if none; the phases after last_phase were skipped
+    Phase over_budget = Phase::Done;
 
     // Compiler Internals
     Arena arena;
@@ -49,21 +107,135 @@ struct Compiler {
 
     bool warns_as_errors = false;
     bool enable_all_warns = true;
+
+private:
+    Ptr<ast::ModDecl> parse(const std::string& file, const std::string& text);
+    // Replace the declarations of module that failed to parse (all of them with exclude_non_parsed_files)
+    // by the declarations of the last text of file that parsed, so that the rest of the program still sees them
+    void substitute_last_parsed(const workspace::File& file, ast::ModDecl& module, size_t first_diagnostic);
+
+    void enter_phase(Phase next) {
+        end_phase();
+        phase_started = std::chrono::steady_clock::now().time_since_epoch().count();
+        phase = next;
+        if (phase_progress) *phase_progress = static_cast<uint64_t>(next);
+        phase_allocations_ = stats::thread_allocations();
+        phase_open_ = next != Phase::Done;
+    }
+    // Record the time and the allocations of the current phase (artic/stats), on the thread that ran it
+    void end_phase();
+
+    stats::Allocations phase_allocations_;
+    bool phase_open_ = false;
+
+    mutable std::mutex line_indexes_mutex_;
+    mutable std::unordered_map<std::string, LineIndex> line_indexes_;
+
+    FlatNameMap flat_names_;
+    bool flat_names_built_ = false;
+    FlatTree flat_tree_;
+    bool flat_tree_built_ = false;
+};
+
+// Small LRU cache of recent compile results.
+// Keyed by a hash of all compile inputs, so that undo/redo, saving without changes
+// or switching tabs back and forth reuse a result instead of compiling again.
+class CompileCache {
+public:
+    explicit CompileCache(size_t capacity = 4)
+        : capacity_(capacity)
+    {}
+
+    // Hash of the file paths and contents (in the given order) and the options affecting the result
+    static uint64_t key(std::span<workspace::File*> files, bool pruned, bool exclude_non_parsed_files, Phase last_phase);
+
+    std::shared_ptr<Compiler> find(uint64_t key) {
+        auto it = std::find_if(entries_.begin(), entries_.end(), [&](const auto& e) { return e.key == key; });
+        if (it == entries_.end()) return nullptr;
+        entries_.splice(entries_.begin(), entries_, it);
+        return entries_.front().compile;
+    }
+
+    // bytes: heap memory held by the compile result (0 if unknown)
+    void insert(uint64_t key, std::shared_ptr<Compiler> compile, size_t bytes = 0) {
+        entries_.push_front(Entry{ key, std::move(compile), bytes });
+        if (entries_.size() > capacity_) entries_.pop_back();
+    }
+
+    // Drop least recently used results (except keep) until bytes are freed.
+    // Returns the number of freed bytes and evicted results.
+    std::pair<size_t, size_t> evict(size_t bytes, const Compiler* keep) {
+        size_t freed = 0, evicted = 0;
+        for (auto it = entries_.end(); it != entries_.begin() && freed < bytes;) {
+            --it;
+            if (it->compile.get() == keep) continue;
+            freed += it->bytes;
+            ++evicted;
+            it = entries_.erase(it);
+        }
+        return { freed, evicted };
+    }
+
+    // Bytes held by cached results other than keep
+    size_t bytes(const Compiler* keep = nullptr) const {
+        size_t res = 0;
+        for (const auto& e : entries_) if (e.compile.get() != keep) res += e.bytes;
+        return res;
+    }
+    size_t size() const { return entries_.size(); }
+
+    void clear() { entries_.clear(); }
+
+private:
+    struct Entry {
+        uint64_t key;
+        std::shared_ptr<Compiler> compile;
+        size_t bytes;
+    };
+    size_t capacity_;
+    // most recently used first
+    std::list<Entry> entries_;
+};
+
+// Keys (see CompileCache::key) of recent input sets, the least recently inserted dropped past capacity
+class RecentKeys {
+public:
+    explicit RecentKeys(size_t capacity)
+        : capacity_(capacity)
+    {}
+
+    bool contains(uint64_t key) const { return std::find(keys_.begin(), keys_.end(), key) != keys_.end(); }
+
+    void insert(uint64_t key) {
+        if (contains(key)) return;
+        keys_.push_front(key);
+        if (keys_.size() > capacity_) keys_.pop_back();
+    }
+
+    void clear() { keys_.clear(); }
+
+private:
+    size_t capacity_;
+    // most recent first
+    std::list<uint64_t> keys_;
 };
 
+// Records the latency of a scope and the allocations of the calling thread in it under label (artic/stats).
+// The label must outlive the timer, e.g. a string literal.
 class Timer {
 public:
     explicit Timer(std::string_view label)
-        : label_(label), start_(std::chrono::steady_clock::now()) {}
+        : label_(label), start_(std::chrono::steady_clock::now()), allocations_(stats::thread_allocations()) {}
 
     ~Timer() {
         auto end = std::chrono::steady_clock::now();
-        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start_).count();
-        // log::info("{} took {} ms", label_, ms);
+        auto ms = std::chrono::duration<double, std::milli>(end - start_).count();
+        stats::record(label_, ms, stats::thread_allocations() - allocations_);
     }
 private:
-    std::string label_;
+    std::string_view label_;
     std::chrono::steady_clock::time_point start_;
+    stats::Allocations allocations_;
 };
 
 } // namespace artic::ls
@@ -2,6 +2,7 @@
 #define ARTIC_LS_CONFIG_H
 
 #include "workspace.h"
+#include "fsscan.h"
 #include <nlohmann/json.hpp>
 #include <vector>
 #include <string>
@@ -82,13 +83,14 @@ struct FilePatternParser {
 private:
     void expand() {
         expand_home();
-        if (!fs::exists(root) || !fs::is_directory(root)) {
+        // Canonicalize the root once, paths built from directory listings below it stay canonical
+        root = fs::weakly_canonical(root);
+        if (fsscan::stat_kind(root) != fsscan::Kind::Directory) {
             log.error("Folder does not exist: {}", root.string());
             return;
         }
         split();
-        dfs(0, root);
-        make_canoncial();
+        dfs(0, root, true);
     }
 
     fs::path root;
@@ -123,12 +125,12 @@ private:
         parts.push_back(cur);
     }
 
-    void dfs(size_t idx,const fs::path& base);
+    // canonical: base is known to be canonical (no symlinks, '.' or '..' on the way from root)
+    void dfs(size_t idx, const fs::path& base, bool canonical);
 
-    void make_canoncial() {
-        for(auto& p : results) {
-            p = fs::weakly_canonical(p);
-        }
+    void add_result(const fs::path& path, bool canonical) {
+        auto norm = canonical ? path : fs::weakly_canonical(path);
+        if(dedup.insert(norm.generic_string()).second) results.emplace_back(std::move(norm));
     }
 };
 
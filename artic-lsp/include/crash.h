@@ -1,10 +1,44 @@
 #ifndef ARTIC_LS_CRASH_H
 #define ARTIC_LS_CRASH_H
 
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+
 namespace artic::ls::crash {
 
 void setup_crash_handler();
 
+struct IsolatedResult {
+    // false if the platform cannot fork or other threads are running, fn was not run
+    bool isolated = false;
+    // the caller was not the only thread: a forked worker could block forever on a lock one of them holds
+    bool threads_running = false;
+    bool crashed = false;
+    int signal = 0;
+    // the worker was killed because expired returned true (not a crash)
+    bool timed_out = false;
+    // last value of the progress word of the worker
+    uint64_t progress = 0;
+};
+
+// Run fn in a forked worker process, so that a crash in fn cannot take down the server.
+// The worker shares all state with the caller (copy-on-write), but none of its effects are visible to the caller.
+// Only forks while the caller is the only thread of the process.
+// fn reports its progress in a word shared with the caller (initially 0). expired(progress) is polled while
+// the worker runs, the worker is killed once it returns true.
+IsolatedResult run_isolated(const std::function<void(std::atomic<uint64_t>& progress)>& fn, const std::function<bool(uint64_t progress)>& expired);
+
+// Start the worker host: a process forked while the caller is the only thread, which from then on forks the workers
+// of run_in_worker_host, also once the caller runs other threads. Each worker calls handler with its request.
+// Call before starting any thread, false if the host could not be started.
+bool start_worker_host(std::function<void(std::string_view request, std::atomic<uint64_t>& progress)> handler);
+
+// Run the handler of the worker host on request in a new worker, as run_isolated runs fn.
+// The worker shares no state with the caller: request has to carry all of its inputs. isolated is false without a host.
+IsolatedResult run_in_worker_host(std::string_view request, const std::function<bool(uint64_t progress)>& expired);
+
 } // namespace artic::ls::crash
 
 #endif // ARTIC_LS_CRASH_H
@@ -0,0 +1,77 @@
+#ifndef ARTIC_LS_DEPGRAPH_H
+#define ARTIC_LS_DEPGRAPH_H
+
+#include <cstdint>
+#include <deque>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace artic::ls::workspace {
+
+struct File;
+
+using Symbol = uint32_t;
+
+// Interned identifiers, so that scanned names are compared and indexed as integers.
+// Ids are stable for the lifetime of the table; the strings are only needed for display.
+// Names are never removed: the owner rebuilds the table from the names still in use (Workspace::compact_symbols).
+class SymbolTable {
+public:
+    Symbol intern(std::string_view name) {
+        if (auto it = ids_.find(name); it != ids_.end()) return it->second;
+        auto id = static_cast<Symbol>(names_.size());
+        ids_.emplace(names_.emplace_back(name), id); // deque: the key views a string that never moves
+        return id;
+    }
+    std::string_view name(Symbol id) const { return names_[id]; }
+    size_t size() const { return names_.size(); }
+
+    void clear() { ids_.clear(); names_.clear(); }
+
+private:
+    std::deque<std::string> names_;
+    std::unordered_map<std::string_view, Symbol> ids_;
+};
+
+// Top-level names declared by a source file and identifiers it uses.
+// Found by a lexical scan, which over-approximates the uses (any identifier counts),
+// so pruning with it never drops a file that is actually needed.
+struct FileSymbols {
+    // both sorted and free of duplicates
+    std::vector<Symbol> declares;
+    std::vector<Symbol> uses;
+    // the declares of structs, enums, type aliases and modules, for completing types
+    std::vector<Symbol> declared_types;
+    // implicits are resolved by type, not by name: such files are always reachable
+    bool has_implicits = false;
+
+    static FileSymbols scan(std::string_view text, SymbolTable& table);
+
+    bool same_declarations(const FileSymbols& other) const {
+        return has_implicits == other.has_implicits && declares == other.declares && declared_types == other.declared_types;
+    }
+};
+
+// Which files declare a top-level name, for all files of a project
+struct NameIndex {
+    // indexed by Symbol
+    std::vector<std::vector<File*>> declared_in;
+    std::vector<File*> with_implicits;
+    // FileSymbols version the index was built from
+    size_t version = 0;
+
+    void add(File* file, const FileSymbols& symbols);
+
+    // Files transitively reachable from root through top-level names, in the order of files
+    std::vector<File*> reachable_from(
+        File* root,
+        std::span<File* const> files,
+        const std::unordered_map<File*, FileSymbols>& symbols) const;
+};
+
+} // namespace artic::ls::workspace
+
+#endif // ARTIC_LS_DEPGRAPH_H
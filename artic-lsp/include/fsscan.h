@@ -0,0 +1,47 @@
+#ifndef ARTIC_LS_FSSCAN_H
+#define ARTIC_LS_FSSCAN_H
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Cheap file system metadata queries for config discovery and glob expansion.
+// std::filesystem issues one blocking stat per query (and several for weakly_canonical),
+// which dominates reload time on network home directories and overlay file systems.
+namespace artic::ls::workspace::fsscan {
+namespace fs = std::filesystem;
+
+enum class Kind : uint8_t { None, File, Directory, Other };
+
+struct Entry {
+    std::string name;
+    Kind kind = Kind::None;
+    // Entry is a symbolic link, kind describes the link target
+    bool is_link = false;
+};
+
+// List all entries of a directory (without "." and "..").
+// Entry kinds are taken from the d_type reported by getdents; only symlinks and
+// file systems that do not report a type cost an additional fstatat relative to the directory.
+// Returns false if the directory cannot be opened.
+bool list_dir(const fs::path& dir, std::vector<Entry>& out);
+
+// Size and last write time of a regular file, in time since the Unix epoch
+struct FileStat {
+    uint64_t size = 0;
+    int64_t mtime_sec = 0;
+    uint32_t mtime_nsec = 0;
+};
+
+// Stat of the regular file at path, following symlinks. False if it does not exist or is not a regular file.
+bool stat_file(const fs::path& path, FileStat& out);
+
+// Kind of the file at path, following symlinks. Kind::None if it does not exist.
+// If is_link is given, it is set to whether path itself is a symlink.
+Kind stat_kind(const fs::path& path, bool* is_link = nullptr);
+
+} // namespace artic::ls::workspace::fsscan
+
+#endif // ARTIC_LS_FSSCAN_H
@@ -0,0 +1,65 @@
+#ifndef ARTIC_LS_GOVERNOR_H
+#define ARTIC_LS_GOVERNOR_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace artic::ls::memory {
+
+// Heap allocator the server is linked with (CMake option ARTIC_LS_ALLOCATOR): "glibc", "mimalloc", "jemalloc" or "system"
+std::string_view allocator_name();
+
+struct AllocatorStats {
+    // bytes in live allocations, 0 if unknown
+    size_t allocated = 0;
+    // bytes the allocator holds from the system, including free space in its pages
+    size_t held = 0;
+    // allocations since process start, 0 if the allocator does not count them
+    uint64_t allocations = 0;
+
+    // share of held bytes that are not allocated, negative if unknown
+    double fragmentation() const { return allocated && held >= allocated ? double(held - allocated) / double(held) : -1.0; }
+};
+AllocatorStats allocator_stats();
+
+// Bytes currently allocated on the heap, 0 if the allocator cannot tell.
+// With mimalloc the committed bytes, which it tracks without statistics builds.
+size_t heap_allocated_bytes();
+// Resident set size of the process, 0 if unknown
+size_t resident_bytes();
+// Return free heap pages to the operating system
+void trim_heap();
+
+enum class Pressure { None, Moderate, Critical };
+
+// Memory pressure of the cgroup the server runs in (cgroup v2): its PSI (memory.pressure, or
+// /proc/pressure/memory outside of a cgroup) and its working set relative to memory.high or memory.max.
+// Pressure::None on platforms without either.
+Pressure memory_pressure();
+
+// Keeps evictable memory (closed file texts, cached compile results) within a budget
+struct Governor {
+    // bytes, 0 = unlimited
+    size_t budget = 0;
+
+    // statistics
+    size_t evicted_texts = 0;
+    size_t evicted_compiles = 0;
+    size_t evicted_bytes = 0;
+
+    Pressure pressure = Pressure::None;
+    // rises of the pressure level
+    size_t pressure_events = 0;
+    // last time the caches were shed under pressure, see Server::respond_to_memory_pressure
+    std::chrono::steady_clock::time_point shed_at;
+
+    // allocator_stats().allocations at the last stats request, for the allocation rate
+    uint64_t sampled_allocations = 0;
+    std::chrono::steady_clock::time_point sampled_at = std::chrono::steady_clock::now();
+};
+
+} // namespace artic::ls::memory
+
+#endif // ARTIC_LS_GOVERNOR_H
@@ -0,0 +1,147 @@
+#ifndef ARTIC_LS_INDEX_H
+#define ARTIC_LS_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace artic::ls::workspace { struct Project; struct File; }
+
+namespace artic::ls::index {
+
+namespace fs = std::filesystem;
+
+// Layout of an index artifact (artic-lsp --index). The file is mapped as is, so every table
+// is an array of these structs at an 8 byte aligned offset. Integers are in host byte order:
+// an artifact of another byte order fails the version check.
+// Strings are referenced by id, id 0 is the empty string.
+namespace format {
+
+inline constexpr char magic[8] = { 'A', 'R', 'T', 'I', 'C', 'I', 'D', 'X' };
+// bump on every change of the layout or of what is indexed
+inline constexpr uint32_t version = 3;
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_files, num_decls, num_symbols, num_strings, string_bytes;
+    // byte offsets from the start of the file
+    uint64_t files, decls, symbols, strings, string_data;
+};
+
+struct String {
+    uint32_t offset, size; // in string_data
+};
+
+struct FileEntry {
+    // relative to the root folder of the project, so the artifact can be moved along with the sources
+    uint32_t path;
+    uint32_t has_implicits;
+    // of the text the entry was built from, to detect stale entries
+    uint64_t size;
+    uint64_t hash;
+    // last write time of the file when indexed, since the Unix epoch (fsscan::stat_file)
+    int64_t mtime_sec;
+    uint32_t mtime_nsec;
+    // string ids in symbols: [declares, uses) are the declared top-level names, [uses, symbols_end) the used identifiers
+    uint32_t declares, uses, symbols_end;
+};
+
+// Top-level declaration, as a completion item
+struct DeclEntry {
+    uint32_t name, label, detail, insert_text;
+    uint32_t kind; // lsp::CompletionItemKind, 0 if none
+    uint32_t is_type;
+};
+
+static_assert(sizeof(Header) == 72 && sizeof(FileEntry) == 48 && sizeof(DeclEntry) == 24);
+
+} // namespace format
+
+// FNV-1a, the hash of FileEntry
+inline uint64_t hash_text(std::string_view text) {
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : text) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Read-only, memory-mapped index artifact.
+// Opening it only checks the header and the table bounds; the tables are paged in on use,
+// so an index of a large library costs next to nothing until its entries are needed.
+class LibraryIndex {
+public:
+    // nullptr with error set if the file is missing, damaged, or of another format version
+    static std::shared_ptr<const LibraryIndex> open(const fs::path& path, std::string& error);
+    ~LibraryIndex();
+
+    LibraryIndex(const LibraryIndex&) = delete;
+    LibraryIndex& operator=(const LibraryIndex&) = delete;
+
+    const fs::path& path() const { return path_; }
+
+    std::span<const format::FileEntry> files() const { return files_; }
+    std::span<const format::DeclEntry> decls() const { return decls_; }
+    std::span<const uint32_t> declares(const format::FileEntry& file) const { return symbols(file.declares, file.uses); }
+    std::span<const uint32_t> uses(const format::FileEntry& file) const { return symbols(file.uses, file.symbols_end); }
+
+    // Empty for an invalid id
+    std::string_view string(uint32_t id) const {
+        if (id >= strings_.size()) return {};
+        auto s = strings_[id];
+        if (uint64_t(s.offset) + s.size > string_data_.size()) return {};
+        return string_data_.substr(s.offset, s.size);
+    }
+
+    // Whether the entry still describes the file: compares the text if it is loaded. Otherwise compares the size
+    // and the last write time on disk, and hashes the file if only the time differs (e.g. a copied library)
+    bool matches(const format::FileEntry& entry, const fs::path& file, const std::string* text) const;
+
+private:
+    LibraryIndex() = default;
+
+    std::span<const uint32_t> symbols(uint32_t begin, uint32_t end) const {
+        if (begin > end || end > symbols_.size()) return {};
+        return symbols_.subspan(begin, end - begin);
+    }
+
+    fs::path path_;
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    // fallback where the file cannot be mapped
+    std::vector<char> buffer_;
+    bool mapped_ = false;
+
+    std::span<const format::FileEntry> files_;
+    std::span<const format::DeclEntry> decls_;
+    std::span<const uint32_t> symbols_;
+    std::span<const format::String> strings_;
+    std::string_view string_data_;
+};
+
+// Analyze the own files of project (compiled together with its dependencies, whose files are
+// all_files) and write the index artifact. Returns false with error set on failure.
+bool write(const fs::path& out, const workspace::Project& project, std::span<workspace::File* const> all_files, std::string& error);
+
+struct Options {
+    // workspace folder, or a config file in it
+    fs::path workspace;
+    // only index this project, all projects with files if empty
+    std::string project;
+    // artifact path, defaults to <project folder>/<project name>.articidx
+    fs::path output;
+};
+
+// artic-lsp --index: writes one artifact per project. Returns the exit status: 0 on success, 1 on failure, 2 if there was nothing to index.
+int run(const Options& options);
+
+} // namespace artic::ls::index
+
+#endif // ARTIC_LS_INDEX_H
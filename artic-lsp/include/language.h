@@ -0,0 +1,51 @@
+#ifndef ARTIC_LS_LANGUAGE_H
+#define ARTIC_LS_LANGUAGE_H
+
+#include "artic/ast.h"
+#include "lines.h"
+#include "location.h"
+#include "namemap.h"
+#include "lsp/types.h"
+
+#include <limits>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Language features implemented in server.cpp that the benchmarks and the indexer call directly
+
+namespace artic::ls {
+
+class Server;
+
+struct IndentifierOccurences{
+    std::string name;
+    std::vector<CompactLoc> all_occurences;
+
+    // Additional info
+    CompactLoc cursor_range;
+    CompactLoc declaration_range;
+};
+
+// Occurrences of the name at the cursor, compiles all project files if necessary
+std::optional<IndentifierOccurences> find_occurrences_of_identifier(Server& server, const Loc& cursor, bool include_declaration);
+
+// Semantic tokens of the names in rows [start_row, end_row] of file
+lsp::SemanticTokens collect(
+    const FlatNameMap& name_map, 
+    const LineIndex* lines,
+    PositionEncoding encoding,
+    const std::string& file, 
+    int start_row = 0, 
+    int end_row = std::numeric_limits<int>::max()
+);
+
+// Declarations that name a type (or a module), the only ones completed after `a : `
+bool is_type_decl(const ast::NamedDecl& decl);
+
+lsp::CompletionItem completion_item(const ast::FnDecl* fn);
+std::optional<lsp::CompletionItem> completion_item(const ast::NamedDecl& decl);
+
+} // namespace artic::ls
+
+#endif // ARTIC_LS_LANGUAGE_H
@@ -0,0 +1,44 @@
+#ifndef ARTIC_LS_LINES_H
+#define ARTIC_LS_LINES_H
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace artic::ls {
+
+// Unit of LSP Position::character, negotiated with the client (UTF-16 if it does not say)
+enum class PositionEncoding { Utf8, Utf16, Utf32 };
+
+// Column conversion for one source file.
+// artic counts columns in code points, LSP in the negotiated encoding. Only lines
+// containing non-ASCII bytes get a conversion table; on all others the units coincide.
+class LineIndex {
+public:
+    explicit LineIndex(std::string_view text);
+
+    // 0-based LSP character of the 1-based artic column col in the 1-based row
+    uint32_t character(uint32_t row, uint32_t col, PositionEncoding encoding) const;
+    // 1-based artic column of the 0-based LSP character in the 1-based row
+    uint32_t column(uint32_t row, uint32_t character, PositionEncoding encoding) const;
+
+    size_t lines() const { return line_starts_.size(); }
+    // Byte offset of the first character of the 1-based row
+    uint32_t line_start(uint32_t row) const { return line_starts_[row - 1]; }
+
+private:
+    struct Line {
+        uint32_t row;
+        // offset of every code point of the line (and of its end) in bytes and in UTF-16 code units
+        std::vector<uint32_t> utf8, utf16;
+    };
+    const Line* non_ascii_line(uint32_t row) const;
+
+    std::vector<uint32_t> line_starts_;
+    // sorted by row
+    std::vector<Line> non_ascii_lines_;
+};
+
+} // namespace artic::ls
+
+#endif // ARTIC_LS_LINES_H
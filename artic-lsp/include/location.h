@@ -0,0 +1,69 @@
+#ifndef ARTIC_LS_LOCATION_H
+#define ARTIC_LS_LOCATION_H
+
+#include "lsp/types.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace artic::ls {
+
+// Interned source files.
+// Every file gets a 32-bit id, one path string shared by all Locs referring to it,
+// and its LSP uri, which is only built once a location of the file is sent to the client.
+class FileTable {
+public:
+    using Id = uint32_t;
+
+    Id intern(const std::string& path) {
+        if (auto it = ids_.find(path); it != ids_.end()) return it->second;
+        auto id = static_cast<Id>(entries_.size());
+        entries_.push_back(Entry{ .path = std::make_shared<std::string>(path) });
+        ids_.emplace(*entries_.back().path, id); // views the shared string, which is never freed
+        return id;
+    }
+
+    // Id of the file behind a client uri, the path is only canonicalized the first time
+    Id from_uri(std::string_view uri_path) {
+        std::string key(uri_path);
+        if (auto it = uri_ids_.find(key); it != uri_ids_.end()) return it->second;
+        auto id = intern(std::filesystem::weakly_canonical(std::filesystem::path(key)).generic_string());
+        uri_ids_.emplace(std::move(key), id);
+        return id;
+    }
+
+    const std::shared_ptr<std::string>& path(Id id) const { return entries_[id].path; }
+
+    const lsp::FileUri& uri(Id id) {
+        auto& entry = entries_[id];
+        if (!entry.uri) entry.uri = lsp::FileUri::fromPath(*entry.path);
+        return *entry.uri;
+    }
+
+private:
+    struct Entry {
+        std::shared_ptr<std::string> path;
+        std::optional<lsp::FileUri> uri;
+    };
+    std::vector<Entry> entries_;
+    std::unordered_map<std::string_view, Id> ids_;
+    std::unordered_map<std::string, Id> uri_ids_;
+};
+
+// Location without a reference-counted file string (20 instead of 32 bytes, no atomic refcounting).
+// Rows and columns are 0-based, as in LSP.
+struct CompactLoc {
+    FileTable::Id file;
+    uint32_t begin_row, begin_col;
+    uint32_t end_row, end_col;
+};
+
+} // namespace artic::ls
+
+#endif // ARTIC_LS_LOCATION_H
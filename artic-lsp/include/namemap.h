@@ -0,0 +1,120 @@
+#ifndef ARTIC_LS_NAMEMAP_H
+#define ARTIC_LS_NAMEMAP_H
+
+#include "artic/ast.h"
+#include "artic/bind.h"
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace artic::ls {
+
+// Where the names of a text compiled under a stand-in file name are in the real file.
+// The last text of a file that parsed is compiled as "<file> (last parsed)" for the declarations
+// that fail to parse now (see Compiler::substitute_last_parsed), its rows outside of the edit are still valid.
+struct Relocation {
+    std::string file;
+    // rows [1, prefix] are the same in both texts, rows from suffix_begin on moved by shift
+    uint32_t prefix = 0, suffix_begin = 1;
+    int32_t shift = 0;
+
+    // Row of old_row in file, nullopt inside of the edit
+    std::optional<uint32_t> row(uint32_t old_row) const {
+        if (old_row <= prefix) return old_row;
+        if (old_row >= suffix_begin) return static_cast<uint32_t>(static_cast<int64_t>(old_row) + shift);
+        return std::nullopt;
+    }
+};
+// by stand-in file name
+using Relocations = std::unordered_map<std::string, Relocation>;
+
+// Read-only flat copy of a NameMap, built once per compile result.
+// Name occurrences are kept per file in contiguous arrays sorted by position,
+// and the references of every declaration in one CSR array (offsets + entries),
+// so semantic tokens, references and rename scan memory instead of hash buckets.
+class FlatNameMap {
+public:
+    using DeclId = uint32_t;
+    using FileId = uint32_t;
+
+    // 1-based rows and columns, end exclusive (as in Loc)
+    struct Span {
+        uint32_t begin_row, begin_col;
+        uint32_t end_row, end_col;
+    };
+
+    // Occurrences of names in one file, structure of arrays sorted by position
+    struct FileNames {
+        std::vector<Span> spans;
+        std::vector<DeclId> decls;
+        std::vector<uint8_t> is_decl;
+
+        size_t size() const { return spans.size(); }
+        // Index range of the occurrences starting in rows [start_row, end_row]
+        std::pair<size_t, size_t> rows(uint32_t start_row, uint32_t end_row) const;
+    };
+
+    struct Occurrence {
+        DeclId decl;
+        bool is_decl;
+        Span span;
+    };
+
+    // Names in the stand-in files of relocations are moved to the real files, those inside of the edit are left out
+    void build(const NameMap& name_map, const Relocations& relocations = {});
+
+    const FileNames* file_names(const std::string& file) const {
+        auto it = file_ids_.find(file);
+        return it == file_ids_.end() ? nullptr : &files_[it->second];
+    }
+
+    // Name occurrence at the (begin of the) cursor
+    std::optional<Occurrence> find_at(const Loc& cursor) const;
+
+    std::optional<DeclId> id_of(const ast::NamedDecl* decl) const {
+        auto it = decl_ids_.find(decl);
+        if (it == decl_ids_.end()) return std::nullopt;
+        return it->second;
+    }
+    const ast::NamedDecl* decl(DeclId id) const { return decls_[id]; }
+    FileId decl_file(DeclId id) const { return decl_files_[id]; }
+    const Span& decl_span(DeclId id) const { return decl_spans_[id]; }
+
+    // References of a declaration, sorted by file and position
+    std::span<const FileId> ref_files(DeclId id) const {
+        return { ref_files_.data() + ref_offsets_[id], ref_files_.data() + ref_offsets_[id + 1] };
+    }
+    std::span<const Span> ref_spans(DeclId id) const {
+        return { ref_spans_.data() + ref_offsets_[id], ref_spans_.data() + ref_offsets_[id + 1] };
+    }
+
+    const std::string& path(FileId id) const { return paths_[id]; }
+
+private:
+    FileId file_id(const std::string& file);
+    DeclId decl_id(const ast::NamedDecl* decl, FileId file, const Span& span);
+
+    std::vector<std::string> paths_;
+    std::unordered_map<std::string, FileId> file_ids_;
+    std::vector<FileNames> files_;
+
+    // per declaration
+    std::unordered_map<const ast::NamedDecl*, DeclId> decl_ids_;
+    std::vector<const ast::NamedDecl*> decls_;
+    std::vector<FileId> decl_files_;
+    std::vector<Span> decl_spans_;
+    std::vector<uint32_t> ref_offsets_;
+
+    // references of all declarations, grouped by declaration (see ref_offsets_)
+    std::vector<FileId> ref_files_;
+    std::vector<Span> ref_spans_;
+};
+
+} // namespace artic::ls
+
+#endif // ARTIC_LS_NAMEMAP_H
@@ -0,0 +1,82 @@
+#ifndef ARTIC_LS_SCOPES_H
+#define ARTIC_LS_SCOPES_H
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <string_view>
+#include <vector>
+
+namespace artic::ls {
+
+// Names visible in nested scopes, in a single open addressing table (linear probing).
+// Binding a name in an inner scope replaces the binding it shadows in place.
+// No container is allocated per scope. Names are views and must outlive the table.
+template <typename T>
+class ScopeTable {
+public:
+    ScopeTable() { slots_.resize(16); }
+
+    void push_scope() { ++depth_; }
+
+    // Bind name in the innermost scope, shadowing outer bindings
+    void insert(std::string_view name, T value) {
+        if ((size_ + 1) * 4 > slots_.size() * 3) grow();
+        auto& slot = slots_[find(name)];
+        if (!slot.value) {
+            slot.name = name;
+            ++size_;
+        }
+        slot.value = value;
+        slot.depth = depth_;
+    }
+
+    // Innermost binding of name, nullptr if unbound
+    T lookup(std::string_view name) const { return slots_[find(name)].value; }
+
+    size_t size() const { return size_; }
+
+    // Visible bindings, those of inner scopes first, by name within a scope.
+    // Deterministic, unlike the order of the table
+    template <typename F>
+    void for_each(F&& f) const {
+        std::vector<const Slot*> bound;
+        bound.reserve(size_);
+        for (const auto& slot : slots_) if (slot.value) bound.push_back(&slot);
+        std::sort(bound.begin(), bound.end(), [](const Slot* a, const Slot* b) {
+            return a->depth != b->depth ? a->depth > b->depth : a->name < b->name;
+        });
+        for (auto slot : bound) f(slot->name, slot->value);
+    }
+
+private:
+    struct Slot {
+        std::string_view name;
+        T value = nullptr;
+        // scope of the binding, 1 for the first pushed
+        size_t depth = 0;
+    };
+
+    size_t home(std::string_view name) const { return std::hash<std::string_view>{}(name) & (slots_.size() - 1); }
+
+    // Slot holding name, or the empty slot where it would be inserted
+    size_t find(std::string_view name) const {
+        auto i = home(name);
+        while (slots_[i].value && slots_[i].name != name) i = (i + 1) & (slots_.size() - 1);
+        return i;
+    }
+
+    void grow() {
+        auto old = std::move(slots_);
+        slots_.assign(old.size() * 2, Slot{});
+        for (const auto& slot : old) if (slot.value) slots_[find(slot.name)] = slot;
+    }
+
+    std::vector<Slot> slots_;
+    size_t size_ = 0;
+    size_t depth_ = 0;
+};
+
+} // namespace artic::ls
+
+#endif // ARTIC_LS_SCOPES_H
@@ -7,10 +7,23 @@
 #include "workspace.h"
 #include "lsp/types.h"
 #include <lsp/connection.h>
+#include <lsp/io/stream.h>
 #include <lsp/messagehandler.h>
 #include <lsp/messagebase.h>
 #include "compile.h"
+#include "config.h"
+#include "crash.h"
+#include "governor.h"
+#include "lines.h"
+#include "location.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <optional>
 #include <span>
+#include <unordered_set>
+#include <vector>
 
 namespace artic::ls {
 
@@ -21,10 +34,14 @@ namespace artic::ls {
 class Server {
 public:
     Server();
+    // Speak LSP over stream instead of stdio, for in-process drivers (bench/soak.cpp)
+    explicit Server(lsp::io::Stream& stream);
     ~Server();
 
     /// Start the LSP server main loop
     int run();
+    // Handler of the worker host (crash::start_worker_host): compile the inputs of a request made by compile_survives_in_worker
+    static void compile_worker_request(std::string_view request, std::atomic<uint64_t>& progress);
     void setup_events() {
         setup_events_initialization();
         setup_events_modifications();
@@ -42,8 +59,18 @@ public:
 
     void send_message(const std::string& message, lsp::MessageType type);
     void compile_files(std::span<const workspace::File*> files);
-    void compile_this_and_related_files(std::filesystem::path file, std::string* new_content = nullptr);
-    void ensure_compile(std::string_view file_view);
+    // full: compile all project files instead of only those reachable from file
+    void compile_this_and_related_files(std::filesystem::path file, std::string* new_content = nullptr, bool full = false);
+    void ensure_compile(std::string_view file_view, bool full = false);
+    // Compile the input set in a worker process first, false if the worker crashed.
+    // over_budget: the phase the worker exceeded compile_budget_ in, Phase::Done if none, unset if it did not tell.
+    bool compile_survives_in_worker(std::span<workspace::File*> files, const std::filesystem::path& active_file, bool prune, uint64_t key, std::optional<Phase>& over_budget);
+    // Run compile.check() within compile_budget_ per phase: skips the phase the isolated worker was killed in (over_budget)
+    // and the later ones, otherwise the phases after the first one that exceeds the budget.
+    void check_within_budget(Compiler& compile, std::optional<Phase> over_budget);
+    // Predicate for the workers of crash::run_isolated and run_in_worker_host (with the compile phase as progress):
+    // true once a phase from Phase::Check on exceeds compile_budget_
+    std::function<bool(uint64_t progress)> budget_expired() const;
 
     enum class FileType { SourceFile, ConfigFile };
     static FileType get_file_type(const std::filesystem::path& file);
@@ -52,10 +79,49 @@ public:
     lsp::MessageHandler message_handler_;
     bool running_ = false;
     bool safe_mode_ = false;
+    // interactive compiles skip project files that the active file cannot reach
+    bool prune_unreachable_files_ = true;
+    // compile in a worker process before compiling in the server (always on in safe mode)
+    bool isolate_compiles_ = false;
+    // input sets that crashed a worker, and that a worker compiled without crashing
+    RecentKeys crashing_inputs_{64};
+    RecentKeys surviving_inputs_{64};
+    // the user was told once that compiles cannot run in a worker process
+    bool isolation_unavailable_reported_ = false;
+    // per compile phase, 0 for no limit
+    std::chrono::milliseconds compile_budget_{5000};
     
     // Project management
     std::unique_ptr<workspace::Workspace> workspace_;
-    std::optional<Compiler> compile;
+    // Loaded in the background after Initialized, the result is the log of the config discovery
+    std::future<workspace::config::ConfigLog> workspace_loading_;
+    // The workspace, waits for the background load to finish
+    workspace::Workspace& workspace();
+    // Compiler state built in the background for the first compile
+    std::shared_ptr<Compiler> spare_compiler_;
+
+    // Startup stages and their time since process start in ms, each recorded once
+    std::vector<std::pair<std::string, double>> startup_stages_;
+    bool startup_done_ = false;
+    void mark_startup(std::string_view stage);
+    std::shared_ptr<Compiler> compile;
+    // files whose last published diagnostics were not empty
+    std::unordered_set<std::string> files_with_diagnostics_;
+    // files of all locations exchanged with the client
+    FileTable file_table_;
+    PositionEncoding position_encoding_ = PositionEncoding::Utf16;
+
+    // LSP position of an artic position (1-based row and column) in file, using the line index of the compile result
+    lsp::Position to_position(const std::string& file, int row, int col) const;
+    // artic position of an LSP position in file
+    Loc::Pos from_position(const std::string& file, const lsp::Position& pos) const;
+    CompileCache compile_cache_;
+    memory::Governor memory_;
+
+    // Evict closed file texts and cached compile results if over the memory budget
+    void enforce_memory_budget();
+    // Shed caches when the memory pressure rises, and at most every 30 s while it lasts. Updates memory_.pressure
+    void respond_to_memory_pressure();
 
     void reload_workspace(const std::string& active_file = {});
     void publish_config_diagnostics(const workspace::config::ConfigLog& log);
@@ -0,0 +1,51 @@
+#ifndef ARTIC_LS_STATS_H
+#define ARTIC_LS_STATS_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace artic::ls::stats {
+
+// Calls of the global operator new and delete. Only counted when built with
+// ARTIC_LS_COUNT_ALLOCATIONS, which replaces them by counting versions.
+struct Allocations {
+    uint64_t count = 0;
+    uint64_t bytes = 0;
+    uint64_t frees = 0;
+
+    Allocations operator-(const Allocations& other) const {
+        return { count - other.count, bytes - other.bytes, frees - other.frees };
+    }
+    Allocations& operator+=(const Allocations& other) {
+        count += other.count;
+        bytes += other.bytes;
+        frees += other.frees;
+        return *this;
+    }
+};
+
+// Whether operator new and delete are counted
+bool counting_allocations();
+// Allocations of the calling thread since it started
+Allocations thread_allocations();
+
+// Latency and allocations of one kind of operation: an LSP request (see Timer) or a compile phase
+struct Summary {
+    std::string name;
+    uint64_t count = 0;
+    double total_ms = 0, max_ms = 0;
+    // over the most recent calls
+    double p50_ms = 0, p99_ms = 0;
+    Allocations allocations;
+};
+
+// Thread-safe
+void record(std::string_view name, double ms, const Allocations& allocations);
+// All recorded operations, sorted by name
+std::vector<Summary> summaries();
+
+} // namespace artic::ls::stats
+
+#endif // ARTIC_LS_STATS_H
@@ -0,0 +1,111 @@
+#ifndef ARTIC_LS_VISIT_H
+#define ARTIC_LS_VISIT_H
+
+#include "artic/ast.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <typeindex>
+#include <unordered_map>
+#include <vector>
+
+namespace artic::ls {
+
+// Index of the first of Ts that node is an instance of (in the sense of isa<>), sizeof...(Ts) if none.
+// The isa<> chain only runs once per dynamic node type and chain, afterwards the result
+// is a typeid lookup (cached per thread, so compiles on worker threads can use it). Switch on it instead of testing isa<> one after another:
+//
+//     switch (classify<ast::FnDecl, ast::StaticDecl>(node)) {
+//         case 0: ... // FnDecl
+//         case 1: ... // StaticDecl
+//         default: ...
+//     }
+template <typename... Ts>
+size_t classify(const ast::Node& node) {
+    static_assert(sizeof...(Ts) < 255);
+    thread_local std::unordered_map<std::type_index, uint8_t> cache;
+    auto [it, inserted] = cache.try_emplace(std::type_index(typeid(node)), uint8_t(0));
+    if (inserted) {
+        uint8_t index = 0;
+        (void)((node.isa<Ts>() ? true : (++index, false)) || ...);
+        it->second = index;
+    }
+    return it->second;
+}
+
+// The nodes of a tree in pre-order, with their depth and the end of their subtree.
+// Recorded with a single TraverseFn pass, so that walks over it call the visitor directly
+// instead of through the std::function of TraverseFn for every node.
+class FlatTree {
+public:
+    struct Entry {
+        const ast::Node* node;
+        uint32_t depth;
+        uint32_t end; // index after the last node of the subtree
+    };
+
+    FlatTree() = default;
+    explicit FlatTree(const ast::Node& root) {
+        std::vector<uint32_t> open;
+        ast::Node::TraverseFn traverse([&](const ast::Node& node) -> bool {
+            auto index = static_cast<uint32_t>(entries_.size());
+            auto depth = static_cast<uint32_t>(traverse.depth);
+            for (; !open.empty() && entries_[open.back()].depth >= depth; open.pop_back())
+                entries_[open.back()].end = index;
+            indexes_.emplace(&node, index);
+            entries_.push_back({ &node, depth, 0 });
+            open.push_back(index);
+            return true;
+        });
+        traverse(root);
+        for (auto index : open) entries_[index].end = static_cast<uint32_t>(entries_.size());
+    }
+
+    const std::vector<Entry>& entries() const { return entries_; }
+    // Index of node in entries(), nullopt if it is not part of the tree
+    std::optional<uint32_t> index_of(const ast::Node& node) const {
+        auto it = indexes_.find(&node);
+        if (it == indexes_.end()) return std::nullopt;
+        return it->second;
+    }
+
+private:
+    std::vector<Entry> entries_;
+    std::unordered_map<const ast::Node*, uint32_t> indexes_;
+};
+
+// Pre-order walk of the subtree of root in tree.
+// enter(node, depth) is inlined into the walk, depth counts from root,
+// and returns whether to descend into the children of node.
+template <typename F>
+void walk(const FlatTree& tree, const ast::Node& root, F&& enter) {
+    auto first = tree.index_of(root);
+    if (!first) {
+        FlatTree subtree(root);
+        if (!subtree.entries().empty()) walk(subtree, root, enter);
+        return;
+    }
+    const auto& entries = tree.entries();
+    auto base = entries[*first].depth;
+    for (uint32_t i = *first, end = entries[*first].end; i < end;) {
+        const auto& entry = entries[i];
+        i = enter(*entry.node, size_t(entry.depth - base)) ? i + 1 : entry.end;
+    }
+}
+
+// Walk only the subtrees whose location contains the cursor, from the outermost to the innermost node.
+// A cursor right behind a node (e.g. while typing an identifier) counts as inside.
+template <typename F>
+void walk_at(const FlatTree& tree, const ast::Node& root, const Loc& cursor, F&& enter) {
+    walk(tree, root, [&](const ast::Node& node, size_t depth) -> bool {
+        if (!node.loc.file) return true; // super module
+        if (!cursor.file || *node.loc.file != *cursor.file) return false;
+        if (!(cursor.end > node.loc.begin && cursor.begin <= node.loc.end)) return false;
+        return enter(node, depth);
+    });
+}
+
+} // namespace artic::ls
+
+#endif // ARTIC_LS_VISIT_H
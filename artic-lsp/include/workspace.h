@@ -4,10 +4,17 @@
 #include "artic/arena.h"
 #include "artic/log.h"
 #include "lsp/types.h"
+#include "fsscan.h"
+#include "depgraph.h"
+#include "index.h"
 #include <system_error>
 #include <unordered_set>
 #include <vector>
 #include <string>
+#include <string_view>
+#include <algorithm>
+#include <cstdint>
+#include <memory>
 #include <optional>
 #include <filesystem>
 #include <unordered_map>
@@ -22,6 +29,13 @@ struct File {
     fs::path path;
     std::optional<std::string> text;
     void read();
+    // Last text of the open file that parsed without errors, stands in for declarations that fail to parse
+    std::optional<std::string> last_parsed_text;
+
+    // open in the editor: text is owned by the client and cannot be re-read from disk
+    bool is_open = false;
+    // Workspace use tick of the last compile including this file
+    uint64_t last_used = 0;
 
     explicit File(fs::path path) 
         : path(std::move(path)), text(std::nullopt) 
@@ -53,10 +67,27 @@ struct Project {
     // Projects will include all files from dependencies
     std::vector<Project::Identifier> dependencies; 
 
+    // Prebuilt index of the files (artic-lsp --index), used instead of reading and scanning them until they are compiled
+    fs::path index;
+
     // -- internal parse info --
     int depth = 100;
 };
 
+// Immutable view of a project's files, built once per project.
+// Projects depending on it link to it by reference instead of re-collecting its files,
+// so a library shared by N projects is resolved only once.
+struct ProjectModule {
+    const Project* project;
+    // own files of the project
+    std::vector<File*> files;
+    // normalized paths of the own files, for membership tests without syscalls
+    std::unordered_set<std::string> paths;
+    std::vector<std::shared_ptr<const ProjectModule>> dependencies;
+    // prebuilt index of the own files, if the project has one
+    std::shared_ptr<const index::LibraryIndex> index;
+};
+
 struct ConfigPath {
     // path to another artic.json
     fs::path path;
@@ -77,24 +108,73 @@ struct ConfigFile {
 
 class Workspace {
 public:
-    Workspace()
-        : arena_(std::make_unique<Arena>())
-    {}
+    // Workspace folders are config roots, their configs are discovered on reload
+    explicit Workspace(std::vector<fs::path> folders = {});
+    ~Workspace();
 
     void reload(config::ConfigLog& log);
 
+    // Discover the configs of the given workspace folders.
+    // Configs of all folders (and their includes) are parsed and expanded concurrently.
+    void add_folders(const std::vector<fs::path>& folders, config::ConfigLog& log);
+    // Forget all configs and projects declared inside the folder
+    void remove_folder(fs::path folder, config::ConfigLog& log);
+    const std::vector<fs::path>& folders() const { return folders_; }
+
     void mark_file_dirty(const fs::path& file) {
-        if(auto f = tracked_file(file)) f->text = std::nullopt;
+        if(auto f = tracked_file(file)) {
+            f->text = std::nullopt;
+            if(symbols_.erase(f)) ++symbols_version_;
+        }
     }
     
+    void set_file_open(const fs::path& file, bool open) {
+        if(auto f = tracked_file(file)) {
+            f->is_open = open;
+            if(!open) f->last_parsed_text = std::nullopt;
+        }
+    }
+
+    // Bytes held by file texts that can be re-read from disk
+    size_t evictable_text_bytes() const {
+        size_t bytes = 0;
+        for (const auto& [_, file] : files_) {
+            if (!file->is_open && file->text) bytes += file->text->size();
+        }
+        return bytes;
+    }
+
+    // Drop texts of files not open in the editor, least recently used first, until bytes are freed.
+    // Returns the number of freed bytes and evicted texts.
+    std::pair<size_t, size_t> evict_closed_texts(size_t bytes) {
+        std::vector<File*> candidates;
+        for (const auto& [_, file] : files_) {
+            if (!file->is_open && file->text) candidates.push_back(file.get());
+        }
+        std::sort(candidates.begin(), candidates.end(), [](const File* a, const File* b) { return a->last_used < b->last_used; });
+
+        size_t freed = 0, evicted = 0;
+        for (auto file : candidates) {
+            if (freed >= bytes) break;
+            freed += file->text->size();
+            file->text = std::nullopt; // re-read by File::read
+            ++evicted;
+        }
+        return { freed, evicted };
+    }
+
     void set_file_content(const fs::path& file, std::string&& content){
-        if(auto f = tracked_file(file)) f->text = std::move(content);
+        if(auto f = tracked_file(file)) {
+            f->text = std::move(content);
+            update_symbols(f);
+        }
     }
 
     // Collect all files that belong to the project containing the given file
     // If no project is found, return just the given file
     // The project config might not be known yet, therefore we may need to look for it and initialize it, hence the log output
-    std::vector<File*> collect_project_files(fs::path file, config::ConfigLog& log) {
+    // prune: only keep the files the given file can reach through top-level names
+    std::vector<File*> collect_project_files(fs::path file, config::ConfigLog& log, bool prune = false) {
         if (auto project = discover_project_for_file(file, log)) {
             auto files = files_for_project(*project);
             bool is_default_project = !uses_file(*project, file);
@@ -102,9 +182,67 @@ public:
                 files.insert(tracked_file(file));
             }
             log::info("Found file '{}' in project '{}' with {} total files {}", file.generic_string(), project->name, files.size(), is_default_project ? " (default project)" : "");
-            return std::vector<File*>(files.begin(), files.end());
+            std::vector<File*> res(files.begin(), files.end());
+            ++use_tick_;
+            for (auto f : res) f->last_used = use_tick_;
+            if (prune) {
+                auto reachable = reachable_files(*project, tracked_file(file), res);
+                log::info("Compiling {} of {} files reachable from '{}'", reachable.size(), res.size(), file.generic_string());
+                return reachable;
+            }
+            return res;
         }
-        return {tracked_file(file)};
+        auto f = tracked_file(file);
+        f->last_used = ++use_tick_;
+        return {f};
+    }
+
+    // Every known project with all its files (including those of its dependencies), sorted by project name and path
+    std::vector<std::pair<const Project*, std::vector<File*>>> all_project_files() {
+        std::vector<std::pair<const Project*, std::vector<File*>>> res;
+        for (const auto& [name, project] : projects_) {
+            auto files = files_for_project(*project);
+            std::vector<File*> sorted(files.begin(), files.end());
+            std::sort(sorted.begin(), sorted.end(), [](const File* a, const File* b) { return a->path < b->path; });
+            res.emplace_back(project.get(), std::move(sorted));
+        }
+        std::sort(res.begin(), res.end(), [](const auto& a, const auto& b) { return a.first->name < b.first->name; });
+        return res;
+    }
+
+    // Files of the project of file that compiled(file) rejects, e.g. those pruned from a compile. Sorted by path
+    template <typename P, typename F>
+    void for_each_file_outside(const fs::path& file, P&& compiled, F&& f) {
+        auto it = project_for_file_cache_.find(fs::weakly_canonical(file));
+        if (it == project_for_file_cache_.end()) return;
+        auto files = files_for_project(*it->second);
+        std::vector<File*> outside;
+        for (auto other : files) if (!compiled(*other)) outside.push_back(other);
+        std::sort(outside.begin(), outside.end(), [](const File* a, const File* b) { return a->path < b->path; });
+        for (auto other : outside) f(*other);
+    }
+
+    // Top-level names declared by the files of for_each_file_outside, from the scan used for pruning: f(name, is_type, file)
+    template <typename P, typename F>
+    void for_each_declaration_outside(const fs::path& file, P&& compiled, F&& f) {
+        for_each_file_outside(file, compiled, [&](File& other) {
+            const auto& symbols = symbols_of(&other);
+            for (auto name : symbols.declares) {
+                bool is_type = std::binary_search(symbols.declared_types.begin(), symbols.declared_types.end(), name);
+                f(symbol_table_.name(name), is_type, other);
+            }
+        });
+    }
+
+    // Prebuilt indexes of the project of file and of its dependencies, for declarations that were pruned from a compile
+    std::vector<std::shared_ptr<const index::LibraryIndex>> indexes_for(const fs::path& file) {
+        std::vector<std::shared_ptr<const index::LibraryIndex>> res;
+        auto it = project_for_file_cache_.find(fs::weakly_canonical(file));
+        if (it == project_for_file_cache_.end()) return res;
+        for_each_module(*module_for(*it->second), [&](const ProjectModule& module) {
+            if (module.index) res.push_back(module.index);
+        });
+        return res;
     }
 
     // return true if file was known before
@@ -123,6 +261,14 @@ public:
     }
 
 private:
+    static constexpr std::string_view config_file_names[] = {
+        ".artic-lsp",
+        "artic.json"
+    };
+
+    struct ParsedConfig;
+    void prefetch_configs(std::vector<ConfigPath> configs);
+
     ConfigFile* instantiate_config(const ConfigPath& origin, config::ConfigLog& log);
     ConfigFile* instantiate_config_json(const ConfigPath& origin, config::ConfigLog& log);
     ConfigFile* instantiate_config_vcxproj(const ConfigPath& origin, config::ConfigLog& log);
@@ -131,7 +277,7 @@ private:
     Project* discover_project_for_file(fs::path file, config::ConfigLog& log) {
         file = fs::weakly_canonical(file);
         if (project_for_file_cache_.contains(file)) {
-            return project_for_file_cache_.at(file).get();
+            return project_for_file_cache_.at(file);
         }
         if (auto project = find_config_recursive(file.parent_path(), file, log)) {
             project_for_file_cache_[file] = project;
@@ -158,15 +304,13 @@ private:
     }
     
     ConfigFile* find_config_in_dir(fs::path dir, const fs::path& file, config::ConfigLog& log) {
-        static constexpr std::string_view file_names[] = {
-            ".artic-lsp",
-            "artic.json"
-        };
-        for (auto file_name : file_names) {
-            auto path = fs::weakly_canonical(dir / file_name);
-            if(!fs::exists(path)) continue;
+        for (auto file_name : config_file_names) {
+            // dir stems from a canonical file path, so only a symlinked config needs canonicalization
+            // (done by instantiate_config). Known configs cost no syscall at all.
+            auto path = dir / file_name;
             if (configs_.contains(path)) 
                 return configs_.at(path).get();
+            if(fsscan::stat_kind(path) == fsscan::Kind::None) continue;
 
             ConfigPath origin{ .path = path };
             if (auto config = instantiate_config(origin, log)) {
@@ -195,34 +339,163 @@ private:
         return nullptr;
     }
 
-    bool uses_file(const Project& project, const fs::path& file) const {
-        log::info("does {} ({} files) use file {}?", project.name, project.files.size(), file.generic_string());
+    bool uses_file(const Project& project, const fs::path& file) {
+        auto key = file_key(file);
+        bool found = false;
+        for_each_module(*module_for(project), [&](const ProjectModule& module) {
+            found = found || module.paths.contains(key);
+        });
+        return found;
+    }
+
+    std::unordered_set<File*> files_for_project(const Project& project) {
+        std::unordered_set<File*> res;
+        for_each_module(*module_for(project), [&](const ProjectModule& module) {
+            res.insert(module.files.begin(), module.files.end());
+        });
+        return res;
+    }
+
+    // Visit a module and its transitive dependencies, each shared dependency only once
+    template <typename F>
+    static void for_each_module(const ProjectModule& root, F&& f) {
+        std::unordered_set<const ProjectModule*> visited;
+        std::vector<const ProjectModule*> stack{ &root };
+        while (!stack.empty()) {
+            auto module = stack.back();
+            stack.pop_back();
+            if (!visited.insert(module).second) continue;
+            f(*module);
+            for (const auto& dep : module->dependencies) stack.push_back(dep.get());
+        }
+    }
+
+    std::shared_ptr<const ProjectModule> module_for(const Project& project) {
+        if (auto it = modules_.find(&project); it != modules_.end())
+            return it->second; // nullptr while under construction (dependency cycle)
+        modules_[&project] = nullptr; // guards against dependency cycles
+
+        auto module = std::make_shared<ProjectModule>();
+        module->project = &project;
+        module->files.reserve(project.files.size());
         for (const auto& f : project.files) {
-            std::error_code ec;
-            // log::info("- comparing with project file {}", f.generic_string());
-            if (fs::equivalent(f, file, ec)) return true;
+            auto file = tracked_file(f);
+            module->files.push_back(file);
+            module->paths.insert(file_key(file->path));
         }
+        if (!project.index.empty()) module->index = load_index(project, module->files);
         for (const auto& dep_id : project.dependencies) {
-            if(auto dep = try_get_project(dep_id)) {
-                if(uses_file(*dep, file)) return true;
+            auto dep = try_get_project(dep_id);
+            if (!dep) continue;
+            if (auto dep_module = module_for(*dep)) module->dependencies.push_back(std::move(dep_module));
+        }
+        modules_[&project] = module;
+        return module;
+    }
+
+    // Map the index of project and remember the entries of its files, nullptr if it cannot be used
+    std::shared_ptr<const index::LibraryIndex> load_index(const Project& project, const std::vector<File*>& files) {
+        std::string error;
+        auto index = index::LibraryIndex::open(project.index, error);
+        if (!index) {
+            log::info("Not using index of project {}: {}", project.name, error);
+            return nullptr;
+        }
+        // entries are relative to the project folder
+        std::unordered_map<std::string, File*> by_path;
+        for (auto file : files) by_path.emplace(file_key(file->path.lexically_relative(project.root_dir)), file);
+        size_t known = 0;
+        for (const auto& entry : index->files()) {
+            if (auto it = by_path.find(file_key(fs::path(index->string(entry.path)))); it != by_path.end()) {
+                indexed_files_[it->second] = { index, &entry };
+                ++known;
             }
         }
-        return false;
+        log::info("Loaded index {} of project {}: {} of {} indexed files are in the project", project.index.generic_string(), project.name, known, index->files().size());
+        return index;
     }
 
-    std::unordered_set<File*> files_for_project(const Project& project) {
-        // note: could first collect all dependencies and then collect files for all of them to avoid duplicate file collection
-        std::unordered_set<File*> res;
-        for (const auto& f : project.files) {
-            res.insert(tracked_file(f));
+    // Import graph -------
+
+    // Symbols of a file from the index of its project, if its entry is not stale
+    std::optional<FileSymbols> indexed_symbols(File* file) {
+        auto it = indexed_files_.find(file);
+        if (it == indexed_files_.end()) return std::nullopt;
+        const auto& [index, entry] = it->second;
+        if (!index->matches(*entry, file->path, file->text ? &*file->text : nullptr)) {
+            log::info("Index entry of {} is stale, scanning the file", file->path.generic_string());
+            indexed_files_.erase(it);
+            return std::nullopt;
         }
-        for (const auto& dep_id : project.dependencies) {
-            if(auto dep = try_get_project(dep_id)) {
-                auto dep_files = files_for_project(*dep);
-                res.insert(dep_files.begin(), dep_files.end());
+        FileSymbols symbols;
+        for (auto id : index->declares(*entry)) symbols.declares.push_back(symbol_table_.intern(index->string(id)));
+        for (auto id : index->uses(*entry))     symbols.uses.push_back(symbol_table_.intern(index->string(id)));
+        // sorted by string in the index, by id here
+        for (auto* symbols_list : { &symbols.declares, &symbols.uses }) {
+            std::sort(symbols_list->begin(), symbols_list->end());
+            symbols_list->erase(std::unique(symbols_list->begin(), symbols_list->end()), symbols_list->end());
+        }
+        symbols.has_implicits = entry->has_implicits;
+        return symbols;
+    }
+
+    const FileSymbols& symbols_of(File* file) {
+        if (auto it = symbols_.find(file); it != symbols_.end()) return it->second;
+        if (auto symbols = indexed_symbols(file)) return symbols_.emplace(file, std::move(*symbols)).first->second;
+        file->read();
+        auto symbols = FileSymbols::scan(file->text ? std::string_view(*file->text) : std::string_view(), symbol_table_);
+        return symbols_.emplace(file, std::move(symbols)).first->second;
+    }
+
+    void update_symbols(File* file) {
+        auto it = symbols_.find(file);
+        if (it == symbols_.end()) return; // scanned lazily
+        auto symbols = FileSymbols::scan(file->text ? std::string_view(*file->text) : std::string_view(), symbol_table_);
+        // name indexes only depend on the declarations
+        if (!symbols.same_declarations(it->second)) ++symbols_version_;
+        it->second = std::move(symbols);
+        if (symbol_table_.size() > compact_symbols_at_) compact_symbols();
+    }
+
+    // Rescanning on every edit interns each prefix of a typed identifier:
+    // rebuild the table from the names of the current scans, renumbering them
+    void compact_symbols() {
+        constexpr Symbol unmapped = ~Symbol(0);
+        SymbolTable table;
+        std::vector<Symbol> remap(symbol_table_.size(), unmapped);
+        for (auto& [file, symbols] : symbols_) {
+            for (auto* symbols_list : { &symbols.declares, &symbols.uses, &symbols.declared_types }) {
+                for (auto& symbol : *symbols_list) {
+                    if (remap[symbol] == unmapped) remap[symbol] = table.intern(symbol_table_.name(symbol));
+                    symbol = remap[symbol];
+                }
+                std::sort(symbols_list->begin(), symbols_list->end());
             }
         }
-        return res;
+        log::info("Compacted symbol table from {} to {} names", symbol_table_.size(), table.size());
+        symbol_table_ = std::move(table);
+        compact_symbols_at_ = std::max<size_t>(min_symbols_to_compact, 2 * symbol_table_.size());
+        // name indexes are indexed by symbol
+        ++symbols_version_;
+    }
+
+    std::vector<File*> reachable_files(const Project& project, File* root, const std::vector<File*>& files) {
+        for (auto file : files) symbols_of(file);
+        auto& index = name_indexes_[&project];
+        if (index.version != symbols_version_) {
+            index = NameIndex{};
+            for (auto file : files) index.add(file, symbols_.at(file));
+            index.version = symbols_version_;
+        }
+        return index.reachable_from(root, files, symbols_);
+    }
+
+    static std::string file_key(const fs::path& file) {
+        auto file_str = file.generic_string();
+        #ifdef _WIN32
+            std::transform(file_str.begin(), file_str.end(), file_str.begin(), ::tolower);
+        #endif
+        return file_str;
     }
 
     File* tracked_file(fs::path file) {
@@ -241,10 +514,28 @@ private:
         return projects_.contains(project_id) ? projects_.at(project_id).get() : nullptr;
     }
 
-    
-    std::unordered_map<fs::path, Ptr<Project>> project_for_file_cache_;
+    std::vector<fs::path> folders_;
+    uint64_t use_tick_ = 0;
+    // Configs parsed ahead of instantiation by prefetch_configs
+    std::unordered_map<fs::path, std::unique_ptr<ParsedConfig>> prefetched_;
+
+    // Non-owning, projects are owned by projects_
+    std::unordered_map<fs::path, Project*> project_for_file_cache_;
 
     std::unordered_map<Project::Identifier, Ptr<Project>> projects_;
+    // Built lazily from projects_, must be invalidated whenever projects_ changes
+    std::unordered_map<const Project*, std::shared_ptr<const ProjectModule>> modules_;
+    std::unordered_map<const Project*, NameIndex> name_indexes_;
+    std::unordered_map<File*, FileSymbols> symbols_;
+    // Index entries of files of projects with an index, the files are only read once they are compiled
+    std::unordered_map<File*, std::pair<std::shared_ptr<const index::LibraryIndex>, const index::format::FileEntry*>> indexed_files_;
+    // identifiers of all scanned files
+    SymbolTable symbol_table_;
+    static constexpr size_t min_symbols_to_compact = 1 << 16;
+    // size of symbol_table_ that triggers compact_symbols
+    size_t compact_symbols_at_ = min_symbols_to_compact;
+    // bumped whenever the declarations of a scanned file change
+    size_t symbols_version_ = 1;
     std::unordered_map<fs::path, Ptr<File>> files_;
     std::unordered_map<fs::path, Ptr<ConfigFile>> configs_;
     std::unique_ptr<Arena> arena_;
@@ -0,0 +1,195 @@
+#include "check.h"
+
+#include "compile.h"
+#include "config.h"
+#include "workspace.h"
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace artic::ls::check {
+
+namespace {
+
+struct Result {
+    std::string file;
+    int begin_row, begin_col, end_row, end_col;
+    std::string severity;
+    std::string message;
+
+    auto key() const { return std::tie(file, begin_row, begin_col, end_row, end_col, message); }
+    bool operator<(const Result& other) const { return key() < other.key(); }
+};
+
+const char* severity_name(const Diagnostic& diag) {
+    switch (diag.severity) {
+        case Diagnostic::Error:   return "error";
+        case Diagnostic::Warning: return "warning";
+        case Diagnostic::Info:    return "info";
+        default:                  return "hint";
+    }
+}
+
+const char* severity_name(lsp::DiagnosticSeverity severity) {
+    switch (severity) {
+        case lsp::DiagnosticSeverity::Error:       return "error";
+        case lsp::DiagnosticSeverity::Warning:     return "warning";
+        case lsp::DiagnosticSeverity::Information: return "info";
+        default:                                   return "hint";
+    }
+}
+
+// A set of files compiled together, shared by all projects with exactly these files
+struct Unit {
+    std::vector<workspace::File*> files;
+    std::vector<std::string> projects;
+    std::vector<Diagnostic> diagnostics;
+    // error of a compile that did not finish
+    std::string failure;
+    double ms = 0;
+};
+
+} // anonymous namespace
+
+int run(const Options& options) {
+    auto start = std::chrono::steady_clock::now();
+    auto folder = fs::weakly_canonical(options.workspace);
+    if (fs::is_regular_file(folder)) folder = folder.parent_path();
+    if (!fs::is_directory(folder)) {
+        std::cerr << "artic-lsp --check: no such folder: " << options.workspace.generic_string() << "\n";
+        return 2;
+    }
+
+    workspace::Workspace workspace({ folder });
+    workspace::config::ConfigLog config_log;
+    workspace.reload(config_log);
+
+    // Projects with equal file sets (e.g. a dependency and a project only adding it) are compiled once
+    std::map<std::vector<workspace::File*>, Unit> units_by_files;
+    for (auto& [project, files] : workspace.all_project_files()) {
+        auto& unit = units_by_files[files];
+        unit.files = files;
+        unit.projects.push_back(project->name);
+    }
+    std::vector<Unit*> units;
+    for (auto& [_, unit] : units_by_files) if (!unit.files.empty()) units.push_back(&unit);
+    if (units.empty()) {
+        std::cerr << "artic-lsp --check: no projects with files in " << folder.generic_string() << "\n";
+        return 2;
+    }
+
+    // Every file is read once, the compiles only read the shared texts.
+    // Unreadable files are left out: the compiles would try to read them again, concurrently
+    std::set<workspace::File*> all_files;
+    for (auto unit : units) all_files.insert(unit->files.begin(), unit->files.end());
+    std::set<workspace::File*> unreadable;
+    for (auto file : all_files) {
+        file->read();
+        if (!file->text) unreadable.insert(file);
+    }
+    if (!unreadable.empty()) {
+        for (auto unit : units) std::erase_if(unit->files, [&](workspace::File* file) { return unreadable.contains(file); });
+        std::erase_if(units, [](const Unit* unit) { return unit->files.empty(); });
+    }
+
+    // Largest units first, so that the last one to finish is a small one
+    std::sort(units.begin(), units.end(), [](const Unit* a, const Unit* b) { return a->files.size() > b->files.size(); });
+    auto jobs = options.jobs ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+    std::atomic<size_t> next = 0;
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < std::min<size_t>(jobs, units.size()); ++i) {
+        workers.emplace_back([&] {
+            for (size_t index; (index = next++) < units.size();) {
+                auto& unit = *units[index];
+                auto unit_start = std::chrono::steady_clock::now();
+                Compiler compiler;
+                try {
+                    compiler.compile_files(unit.files, unit.files.front()->path);
+                } catch (const std::exception& e) {
+                    unit.failure = e.what();
+                }
+                unit.diagnostics = std::move(compiler.diagnostics);
+                unit.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - unit_start).count();
+            }
+        });
+    }
+    for (auto& worker : workers) worker.join();
+
+    // Files shared by several units report each diagnostic once
+    std::set<Result> results;
+    for (const auto& message : config_log.messages) {
+        results.insert(Result{ message.file.generic_string(), 1, 1, 1, 1, severity_name(message.severity), message.message });
+    }
+    for (auto file : unreadable) {
+        results.insert(Result{ file->path.generic_string(), 1, 1, 1, 1, "error", "cannot read file" });
+    }
+    for (auto unit : units) {
+        if (!unit->failure.empty()) {
+            results.insert(Result{ unit->files.front()->path.generic_string(), 1, 1, 1, 1, "error",
+                "compilation of project " + unit->projects.front() + " failed: " + unit->failure });
+        }
+        for (const auto& diag : unit->diagnostics) {
+            results.insert(Result{
+                diag.loc.file ? *diag.loc.file : std::string(),
+                diag.loc.begin.row, diag.loc.begin.col, diag.loc.end.row, diag.loc.end.col,
+                severity_name(diag), diag.message,
+            });
+        }
+    }
+    size_t errors = 0, warnings = 0;
+    for (const auto& res : results) {
+        errors   += res.severity == std::string_view("error");
+        warnings += res.severity == std::string_view("warning");
+    }
+    auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    if (options.json_file.empty()) {
+        for (const auto& res : results)
+            std::printf("%s:%d:%d: %s: %s\n", res.file.c_str(), res.begin_row, res.begin_col, res.severity.c_str(), res.message.c_str());
+        std::printf("%zu error(s), %zu warning(s) in %zu file(s) of %zu project(s), %.0f ms with %u job(s)\n",
+            errors, warnings, all_files.size(), units_by_files.size(), ms, jobs);
+    } else {
+        nlohmann::json diagnostics = nlohmann::json::array();
+        for (const auto& res : results) {
+            diagnostics.push_back({
+                {"file", res.file},
+                {"line", res.begin_row}, {"column", res.begin_col},
+                {"endLine", res.end_row}, {"endColumn", res.end_col},
+                {"severity", res.severity},
+                {"message", res.message},
+            });
+        }
+        nlohmann::json projects = nlohmann::json::array();
+        for (auto unit : units) {
+            for (const auto& name : unit->projects)
+                projects.push_back({ {"name", name}, {"files", unit->files.size()}, {"ms", unit->ms} });
+        }
+        nlohmann::json out = {
+            {"errors", errors},
+            {"warnings", warnings},
+            {"files", all_files.size()},
+            {"jobs", jobs},
+            {"ms", ms},
+            {"projects", projects},
+            {"diagnostics", diagnostics},
+        };
+        if (options.json_file == "-") std::cout << out.dump(4) << "\n";
+        else std::ofstream(options.json_file) << out.dump(4) << "\n";
+    }
+    return errors ? 1 : 0;
+}
+
+} // namespace artic::ls::check
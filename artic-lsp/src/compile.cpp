@@ -5,7 +5,11 @@
 #include "artic/bind.h"
 #include "artic/check.h"
 #include "artic/summoner.h"
+#include <functional>
 #include <iostream>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
 
 namespace {
 
@@ -42,33 +46,38 @@ struct MemBuf : public std::streambuf {
 
 namespace artic::ls {
 
-void Compiler::compile_files(std::span<workspace::File*> files, std::filesystem::path active_file) {
+std::string_view phase_name(Phase phase) {
+    switch (phase) {
+        case Phase::Parse:  return "parsing";
+        case Phase::Bind:   return "name binding";
+        case Phase::Check:  return "type checking";
+        case Phase::Summon: return "summoning";
+        default:            return "done";
+    }
+}
+
+void Compiler::parse_and_bind(std::span<workspace::File*> files, std::filesystem::path active_file) {
+    enter_phase(Phase::Parse);
     program = arena.make_ptr<ast::ModDecl>();
     this->active_file = active_file;
 
     for (auto& file : files){
         file->read();
         auto prev_errors = log.errors;
+        auto prev_diagnostics = diagnostics.size();
         if (!file->text) {
             log::error("cannot open file '{}'", file->path);
             continue;
         }
-        if (log.locator)
-            log.locator->register_file(file->path.generic_string(), file->text.value());
-
-        MemBuf mem_buf(file->text.value());
-        std::istream is(&mem_buf);
-
-        Lexer lexer(log, file->path.generic_string(), is);
-        Parser parser(log, lexer, arena);
-        parser.warns_as_errors = warns_as_errors;
-        auto module = parser.parse();
+        auto module = parse(file->path.generic_string(), file->text.value());
 
         if(log.errors > prev_errors) {
             log::error("Parsing failed for file {}", file->path);
-            if(exclude_non_parsed_files) continue;
-        } else {
+            if(file->last_parsed_text) substitute_last_parsed(*file, *module, prev_diagnostics);
+            else if(exclude_non_parsed_files) continue;
+        } else if(file->is_open && file->last_parsed_text != file->text) {
             // log::info("Parsing success for file {}", file->path);
+            file->last_parsed_text = file->text;
         }
         program->decls.insert(
             program->decls.end(),
@@ -84,13 +93,138 @@ void Compiler::compile_files(std::span<workspace::File*> files, std::filesystem:
         log::error("Parsing failed");
     }
 
+    enter_phase(Phase::Bind);
     (void)name_binder.run(*program);
-    if(!type_checker.run(*program))
-        return;
-    
-    Summoner summoner(log, arena);
-    if(!summoner.run(*program))
-        return;
+    // check() may continue on another thread
+    end_phase();
+}
+
+void Compiler::check() {
+    if(last_phase >= Phase::Check) {
+        enter_phase(Phase::Check);
+        bool checked = type_checker.run(*program);
+        end_phase();
+        if(checked && last_phase >= Phase::Summon) {
+            enter_phase(Phase::Summon);
+            Summoner summoner(log, arena);
+            (void)summoner.run(*program);
+        }
+    }
+    enter_phase(Phase::Done);
+}
+
+void Compiler::end_phase() {
+    if (!phase_open_) return;
+    phase_open_ = false;
+    auto ticks = std::chrono::steady_clock::now().time_since_epoch().count() - phase_started;
+    auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::duration(ticks)).count();
+    static constexpr std::string_view names[] = { "Compile: parsing", "Compile: name binding", "Compile: type checking", "Compile: summoning" };
+    auto current = phase.load();
+    stats::record(names[static_cast<size_t>(current)], ms, stats::thread_allocations() - phase_allocations_);
+
+    if (phase_budget.count() > 0 && current >= Phase::Check && last_phase > current
+        && std::chrono::steady_clock::duration(ticks) > phase_budget) {
+        over_budget = current;
+        last_phase = current;
+    }
+}
+
+Ptr<ast::ModDecl> Compiler::parse(const std::string& file, const std::string& text) {
+    if (log.locator)
+        log.locator->register_file(file, text);
+
+    MemBuf mem_buf(text);
+    std::istream is(&mem_buf);
+
+    Lexer lexer(log, file, is);
+    Parser parser(log, lexer, arena);
+    parser.warns_as_errors = warns_as_errors;
+    return parser.parse();
+}
+
+const LineIndex* Compiler::lines(const std::string& file) const {
+    std::lock_guard lock(line_indexes_mutex_);
+    if (auto it = line_indexes_.find(file); it != line_indexes_.end()) return &it->second;
+    // the text registered with the locator by parse()
+    auto text = locator.data(file);
+    if (!text) return nullptr;
+    return &line_indexes_.emplace(file, LineIndex(text)).first->second;
+}
+
+// Rows that old_text and text have in common before and after the edit between them
+static Relocation relocation(std::string file, std::string_view old_text, std::string_view text) {
+    auto split = [](std::string_view text) {
+        std::vector<std::string_view> rows;
+        for (size_t begin = 0;;) {
+            auto end = text.find('\n', begin);
+            rows.push_back(text.substr(begin, end == std::string_view::npos ? end : end - begin));
+            if (end == std::string_view::npos) return rows;
+            begin = end + 1;
+        }
+    };
+    auto old_rows = split(old_text), rows = split(text);
+    size_t prefix = 0, suffix = 0, common = std::min(old_rows.size(), rows.size());
+    while (prefix < common && old_rows[prefix] == rows[prefix]) ++prefix;
+    while (suffix < common - prefix && old_rows[old_rows.size() - 1 - suffix] == rows[rows.size() - 1 - suffix]) ++suffix;
+    return Relocation {
+        .file = std::move(file),
+        .prefix = static_cast<uint32_t>(prefix),
+        .suffix_begin = static_cast<uint32_t>(old_rows.size() - suffix + 1),
+        .shift = static_cast<int32_t>(static_cast<int64_t>(rows.size()) - static_cast<int64_t>(old_rows.size())),
+    };
+}
+
+void Compiler::substitute_last_parsed(const workspace::File& file, ast::ModDecl& module, size_t first_diagnostic) {
+    // A declaration is broken if a parse error starts inside of it, in safe mode all are
+    auto broken = [&](const ast::Decl& decl) {
+        if (exclude_non_parsed_files) return true;
+        for (size_t i = first_diagnostic; i < diagnostics.size(); ++i) {
+            const auto& diag = diagnostics[i];
+            if (diag.severity == Diagnostic::Error && decl.loc.begin <= diag.loc.begin && diag.loc.begin <= decl.loc.end)
+                return true;
+        }
+        return false;
+    };
+    std::unordered_set<std::string> kept;
+    std::erase_if(module.decls, [&](const Ptr<ast::Decl>& decl) {
+        if (broken(*decl)) return true;
+        if (auto named = decl->isa<ast::NamedDecl>()) kept.insert(named->id.name);
+        return false;
+    });
+
+    // The old declarations get their own file name: their locations refer to the old text,
+    // and the diagnostics of the file must not show up at them. Where the rows of the old text
+    // are still in the current one, their names and diagnostics are relocated to the file.
+    auto stand_in = file.path.generic_string() + " (last parsed)";
+    relocations.insert_or_assign(stand_in, relocation(file.path.generic_string(), *file.last_parsed_text, file.text.value()));
+    auto last = parse(stand_in, *file.last_parsed_text);
+    size_t substituted = 0;
+    for (auto& decl : last->decls) {
+        auto named = decl->isa<ast::NamedDecl>();
+        if (!named || kept.contains(named->id.name)) continue;
+        module.decls.push_back(std::move(decl));
+        ++substituted;
+    }
+    log::info("Substituted {} declaration(s) of {} by their last parsed version", substituted, file.path);
+}
+
+uint64_t CompileCache::key(std::span<workspace::File*> files, bool pruned, bool exclude_non_parsed_files, Phase last_phase) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    auto combine = [&](uint64_t value) {
+        hash ^= value + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+    };
+    for (auto* file : files) {
+        file->read();
+        combine(std::hash<std::string>{}(file->path.generic_string()));
+        combine(file->text ? std::hash<std::string_view>{}(*file->text) : 0);
+        // substituted for declarations that fail to parse
+        if (file->last_parsed_text && file->last_parsed_text != file->text)
+            combine(std::hash<std::string_view>{}(*file->last_parsed_text));
+    }
+    combine(pruned);
+    combine(exclude_non_parsed_files);
+    combine(static_cast<uint64_t>(last_phase));
+    return hash;
 }
 
 
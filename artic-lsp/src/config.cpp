@@ -197,10 +197,10 @@ std::optional<Project> ConfigParser::parse_project(const nlohmann::json& pj) {
     p.dependencies =  pj.value<std::vector<std::string>>("dependencies", {});
     p.origin = config.path;
     p.file_patterns = pj.value<std::vector<std::string>>("files", {});
+    if (auto index = pj.value<std::string>("index", ""); !index.empty()) p.index = to_absolute_path(root, index);
+    // FilePatternParser already yields canonical paths
     auto files = evaluate_patterns(p);
-    for (auto& file : files) {
-        p.files.push_back(fs::weakly_canonical(file));
-    }
+    p.files.assign(files.begin(), files.end());
     return p;
 }
 
@@ -270,13 +270,10 @@ std::unordered_set<fs::path> ConfigParser::evaluate_patterns(Project& project) {
     return matched_files;
 }
 
-void FilePatternParser::dfs(size_t idx,const fs::path& base){
+void FilePatternParser::dfs(size_t idx, const fs::path& base, bool canonical){
     if(idx == parts.size()) {
         // End: if base is a regular file, record it.
-        if(fs::is_regular_file(base)) {
-            auto norm = fs::weakly_canonical(base);
-            if(dedup.insert(norm.generic_string()).second) results.emplace_back(norm);
-        }
+        if(fsscan::stat_kind(base) == fsscan::Kind::File) add_result(base, canonical);
         return;
     }
 
@@ -285,17 +282,19 @@ void FilePatternParser::dfs(size_t idx,const fs::path& base){
     // Special case: '**' as its own segment matches zero or more directory levels.
     if(part == "**") {
         // 1) Match zero directories
-        dfs(idx+1, base);
+        dfs(idx+1, base, canonical);
         // 2) Recurse into subdirectories (unbounded)
         // Guard against huge traversals
         size_t dir_count = 0;
-        for(auto it = fs::directory_iterator(base); it != fs::directory_iterator(); ++it) {
-            if(!it->is_directory()) continue;
+        std::vector<fsscan::Entry> entries;
+        fsscan::list_dir(base, entries);
+        for(const auto& entry : entries) {
+            if(entry.kind != fsscan::Kind::Directory) continue;
             if(++dir_count > 20'000) { // arbitrary safety cap
                 log.warn("Stopped expanding '**' due to excessive directories", part);
                 break;
             }
-            dfs(idx, it->path()); // stay on same ** index
+            dfs(idx, base / entry.name, canonical && !entry.is_link); // stay on same ** index
         }
         return;
     }
@@ -303,15 +302,15 @@ void FilePatternParser::dfs(size_t idx,const fs::path& base){
     // If last component and refers to a file name directly without wildcards
     if(!is_wildcard(part)) {
         fs::path next = base / part;
+        bool is_link = false;
+        auto kind = fsscan::stat_kind(next, &is_link);
+        bool next_canonical = canonical && !is_link && !part.empty() && part != "." && part != "..";
         if(idx + 1 == parts.size()) {
-            if(fs::is_regular_file(next)) {
-                auto norm = fs::weakly_canonical(next);
-                if(dedup.insert(norm.generic_string()).second) results.emplace_back(norm);
-            }
+            if(kind == fsscan::Kind::File) add_result(next, next_canonical);
             return; // even if it is directory but pattern ended, we only collect files
         } else {
-            if(fs::is_directory(next)) {
-                dfs(idx+1, next);
+            if(kind == fsscan::Kind::Directory) {
+                dfs(idx+1, next, next_canonical);
             }
         }
         return;
@@ -319,18 +318,15 @@ void FilePatternParser::dfs(size_t idx,const fs::path& base){
 
     // Wildcard segment (but not **) -> enumerate entries in this directory only
     size_t checked = 0;
-    for(auto it = fs::directory_iterator(base); it != fs::directory_iterator(); ++it) {
+    std::vector<fsscan::Entry> entries;
+    fsscan::list_dir(base, entries);
+    for(const auto& entry : entries) {
         if(++checked > 1'000) { log.warn("Stopped expanding wildcard: too many entries", part); break; }
-        const auto& path = it->path();
-        std::string filename = path.filename().generic_string();
-        if(fnmatch(part.c_str(), filename.c_str(), 0) == 0) {
+        if(fnmatch(part.c_str(), entry.name.c_str(), 0) == 0) {
             if(idx + 1 == parts.size()) {
-                if(it->is_regular_file()) {
-                    auto norm = fs::weakly_canonical(path);
-                    if(dedup.insert(norm.generic_string()).second) results.emplace_back(norm);
-                }
-            } else if(it->is_directory()) {
-                dfs(idx+1, path);
+                if(entry.kind == fsscan::Kind::File) add_result(base / entry.name, canonical && !entry.is_link);
+            } else if(entry.kind == fsscan::Kind::Directory) {
+                dfs(idx+1, base / entry.name, canonical && !entry.is_link);
             }
         }
     }
@@ -3,7 +3,29 @@
 // #include "b_stacktrace.h"
 #include <iostream>
 #include <csignal>
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#if !defined(_WIN32)
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <fstream>
+#include <string>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#endif
 
 namespace artic::ls::crash {
 
@@ -34,4 +56,249 @@ void setup_crash_handler() {
     signal(SIGILL, crash_handler);
 }
 
+// Threads of this process, 0 if unknown
+static size_t thread_count() {
+#if defined(__linux__)
+    std::ifstream status("/proc/self/status");
+    for (std::string line; std::getline(status, line);) {
+        if (line.rfind("Threads:", 0) == 0) return std::strtoul(line.c_str() + 8, nullptr, 10);
+    }
+    return 0;
+#elif defined(__APPLE__)
+    thread_act_array_t threads;
+    mach_msg_type_number_t count = 0;
+    if (task_threads(mach_task_self(), &threads, &count) != KERN_SUCCESS) return 0;
+    for (mach_msg_type_number_t i = 0; i < count; ++i) mach_port_deallocate(mach_task_self(), threads[i]);
+    vm_deallocate(mach_task_self(), reinterpret_cast<vm_address_t>(threads), count * sizeof(thread_act_t));
+    return count;
+#else
+    return 0;
+#endif
+}
+
+IsolatedResult run_isolated(const std::function<void(std::atomic<uint64_t>& progress)>& fn, const std::function<bool(uint64_t progress)>& expired) {
+#if defined(_WIN32)
+    return {};
+#else
+    // Only the forking thread exists in the child: a lock held by another thread (allocator, log, stats) stays locked
+    if (thread_count() != 1) return { .threads_running = true };
+
+    // the progress word lives in a page shared with the worker, stores to it are seen across the fork
+    static_assert(std::atomic<uint64_t>::is_always_lock_free);
+    void* shared = mmap(nullptr, sizeof(std::atomic<uint64_t>), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) return {};
+    auto progress = new (shared) std::atomic<uint64_t>(0);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        munmap(shared, sizeof(std::atomic<uint64_t>));
+        return {};
+    }
+    if (pid == 0) {
+        // Worker: exceptions are not crashes, the caller sees them when running fn itself
+        try { fn(*progress); } catch (...) {}
+        // _exit: do not flush stdio buffers inherited from the server (stdout is the LSP connection)
+        _exit(0);
+    }
+
+    IsolatedResult result{ .isolated = true };
+    int status = 0;
+    bool reaped = false, failed = false;
+    // No waitpid with a timeout: poll, sleeping up to 10 ms in between
+    auto sleep = std::chrono::microseconds(100);
+    while (!reaped) {
+        auto done = waitpid(pid, &status, WNOHANG);
+        if (done < 0) {
+            if (errno == EINTR) continue;
+            failed = true;
+            break;
+        }
+        reaped = done == pid;
+        if (reaped) break;
+        if (expired(progress->load())) {
+            kill(pid, SIGKILL);
+            result.timed_out = true;
+            break;
+        }
+        std::this_thread::sleep_for(sleep);
+        sleep = std::min(sleep * 2, std::chrono::microseconds(10000));
+    }
+    // reap the killed worker
+    while (result.timed_out && waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+    result.progress = progress->load();
+    munmap(shared, sizeof(std::atomic<uint64_t>));
+    if (failed) return {};
+    if (WIFSIGNALED(status) && !result.timed_out) {
+        result.crashed = true;
+        result.signal = WTERMSIG(status);
+    }
+    return result;
+#endif
+}
+
+#if !defined(_WIN32)
+// Server side of the worker host, guarded by mutex: one request at a time
+static struct {
+    std::mutex mutex;
+    pid_t pid = -1;
+    int socket = -1;
+    std::atomic<uint64_t>* progress = nullptr;
+} host;
+
+// MSG_NOSIGNAL: a host that died must not take the server down with SIGPIPE (SO_NOSIGPIPE on Apple)
+#if defined(MSG_NOSIGNAL)
+static constexpr int send_flags = MSG_NOSIGNAL;
+#else
+static constexpr int send_flags = 0;
+#endif
+
+static bool send_all(int socket, const void* data, size_t size) {
+    for (auto bytes = static_cast<const char*>(data); size;) {
+        auto sent = send(socket, bytes, size, send_flags);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+        bytes += sent;
+        size -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+static bool receive_all(int socket, void* data, size_t size) {
+    for (auto bytes = static_cast<char*>(data); size;) {
+        auto received = recv(socket, bytes, size, 0);
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) return false;
+        bytes += received;
+        size -= static_cast<size_t>(received);
+    }
+    return true;
+}
+
+// Requests are a size and the bytes, each is answered with the pid of its worker (-1 if the fork failed)
+// and, once it is reaped, its wait status. Ends when the server closes its end.
+[[noreturn]] static void host_loop(int socket, std::atomic<uint64_t>& progress,
+    const std::function<void(std::string_view request, std::atomic<uint64_t>& progress)>& handler) {
+    // stdin and stdout are the LSP connection of the server
+    if (int null = open("/dev/null", O_RDWR); null >= 0) {
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        close(null);
+    }
+    std::string request;
+    for (uint64_t size; receive_all(socket, &size, sizeof(size));) {
+        request.resize(size);
+        if (!receive_all(socket, request.data(), size)) break;
+        pid_t worker = fork();
+        if (worker == 0) {
+            close(socket);
+            // as in run_isolated: exceptions are not crashes
+            try { handler(request, progress); } catch (...) {}
+            _exit(0);
+        }
+        int32_t pid = worker;
+        if (!send_all(socket, &pid, sizeof(pid))) break;
+        if (worker < 0) continue;
+        int status = 0;
+        while (waitpid(worker, &status, 0) < 0 && errno == EINTR) {}
+        int32_t reply = status;
+        if (!send_all(socket, &reply, sizeof(reply))) break;
+    }
+    _exit(0);
+}
+
+static void stop_worker_host() {
+    close(host.socket);
+    kill(host.pid, SIGKILL);
+    while (waitpid(host.pid, nullptr, 0) < 0 && errno == EINTR) {}
+    host.pid = -1;
+    host.socket = -1;
+}
+#endif
+
+bool start_worker_host(std::function<void(std::string_view request, std::atomic<uint64_t>& progress)> handler) {
+#if defined(_WIN32)
+    return false;
+#else
+    std::lock_guard lock(host.mutex);
+    if (host.pid >= 0) return true;
+    if (thread_count() != 1) return false;
+
+    // shared with the host and all of its workers
+    if (!host.progress) {
+        void* shared = mmap(nullptr, sizeof(std::atomic<uint64_t>), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (shared == MAP_FAILED) return false;
+        host.progress = new (shared) std::atomic<uint64_t>(0);
+    }
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) return false;
+#if defined(__APPLE__)
+    int on = 1;
+    setsockopt(sockets[0], SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    // not inherited by the workers of run_isolated or by the processes the server runs
+    fcntl(sockets[0], F_SETFD, FD_CLOEXEC);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(sockets[0]);
+        close(sockets[1]);
+        return false;
+    }
+    if (pid == 0) {
+        close(sockets[0]);
+        host_loop(sockets[1], *host.progress, handler);
+    }
+    close(sockets[1]);
+    host.pid = pid;
+    host.socket = sockets[0];
+    return true;
+#endif
+}
+
+IsolatedResult run_in_worker_host(std::string_view request, const std::function<bool(uint64_t progress)>& expired) {
+#if defined(_WIN32)
+    return {};
+#else
+    std::lock_guard lock(host.mutex);
+    if (host.pid < 0) return {};
+    host.progress->store(0);
+
+    uint64_t size = request.size();
+    int32_t worker = -1;
+    if (!send_all(host.socket, &size, sizeof(size)) || !send_all(host.socket, request.data(), request.size())
+        || !receive_all(host.socket, &worker, sizeof(worker))) {
+        stop_worker_host();
+        return {};
+    }
+    if (worker < 0) return {};
+
+    // The status arrives once the host reaped the worker: poll, waiting up to 10 ms in between
+    IsolatedResult result{ .isolated = true };
+    for (int timeout = 1;; timeout = std::min(timeout * 2, 10)) {
+        pollfd reply{ .fd = host.socket, .events = POLLIN, .revents = 0 };
+        auto ready = poll(&reply, 1, timeout);
+        if (ready < 0 && errno != EINTR) {
+            stop_worker_host();
+            return {};
+        }
+        if (ready > 0) break;
+        if (!result.timed_out && expired(host.progress->load())) {
+            kill(worker, SIGKILL);
+            result.timed_out = true;
+        }
+    }
+    int32_t status = 0;
+    if (!receive_all(host.socket, &status, sizeof(status))) {
+        stop_worker_host();
+        return {};
+    }
+    result.progress = host.progress->load();
+    if (WIFSIGNALED(status) && !result.timed_out) {
+        result.crashed = true;
+        result.signal = WTERMSIG(status);
+    }
+    return result;
+#endif
+}
+
 } // namespace artic::ls::crash
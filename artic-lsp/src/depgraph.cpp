@@ -0,0 +1,257 @@
+#include "depgraph.h"
+
+#include <algorithm>
+#include <bit>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <unordered_set>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace artic::ls::workspace {
+
+// FileSymbols -----------------------------------------------------------------
+
+static bool is_ident_begin(char c) { return std::isalpha(static_cast<unsigned char>(c)) || c == '_'; }
+static bool is_ident_char (char c) { return std::isalnum(static_cast<unsigned char>(c)) || c == '_'; }
+static bool is_space(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+
+// 16 or 32 byte wide byte classification, scalar loops handle the tail and other targets
+#if defined(__AVX2__)
+#define ARTIC_LS_SIMD 1
+namespace simd {
+    using Vec = __m256i;
+    constexpr size_t width = 32;
+    inline Vec load(const char* p)        { return _mm256_loadu_si256(reinterpret_cast<const Vec*>(p)); }
+    inline Vec set1(char c)               { return _mm256_set1_epi8(c); }
+    inline Vec eq(Vec a, Vec b)           { return _mm256_cmpeq_epi8(a, b); }
+    inline Vec gt(Vec a, Vec b)           { return _mm256_cmpgt_epi8(a, b); }
+    inline Vec add(Vec a, Vec b)          { return _mm256_add_epi8(a, b); }
+    inline Vec bit_or(Vec a, Vec b)       { return _mm256_or_si256(a, b); }
+    inline uint32_t mask(Vec a)           { return static_cast<uint32_t>(_mm256_movemask_epi8(a)); }
+}
+#elif defined(__SSE2__)
+#define ARTIC_LS_SIMD 1
+namespace simd {
+    using Vec = __m128i;
+    constexpr size_t width = 16;
+    inline Vec load(const char* p)        { return _mm_loadu_si128(reinterpret_cast<const Vec*>(p)); }
+    inline Vec set1(char c)               { return _mm_set1_epi8(c); }
+    inline Vec eq(Vec a, Vec b)           { return _mm_cmpeq_epi8(a, b); }
+    inline Vec gt(Vec a, Vec b)           { return _mm_cmpgt_epi8(a, b); }
+    inline Vec add(Vec a, Vec b)          { return _mm_add_epi8(a, b); }
+    inline Vec bit_or(Vec a, Vec b)       { return _mm_or_si128(a, b); }
+    inline uint32_t mask(Vec a)           { return static_cast<uint32_t>(_mm_movemask_epi8(a)); }
+}
+#endif
+
+#ifdef ARTIC_LS_SIMD
+namespace simd {
+    constexpr uint32_t all = width == 32 ? ~0u : (1u << width) - 1;
+
+    // bytes in [lo, hi]: shift lo to -128 and compare signed
+    inline Vec in_range(Vec v, char lo, char hi) {
+        return gt(set1(static_cast<char>(0x80 + (hi - lo + 1))), add(v, set1(static_cast<char>(0x80 - lo))));
+    }
+    inline Vec is_ident_char(Vec v) {
+        return bit_or(bit_or(in_range(bit_or(v, set1(0x20)), 'a', 'z'), in_range(v, '0', '9')), eq(v, set1('_')));
+    }
+    inline Vec is_space(Vec v) {
+        return bit_or(bit_or(eq(v, set1(' ')), eq(v, set1('\t'))), bit_or(eq(v, set1('\n')), eq(v, set1('\r'))));
+    }
+}
+#endif
+
+// Index of the first byte at or after i that does not continue an identifier (or number)
+static size_t scan_ident(std::string_view text, size_t i) {
+    const size_t n = text.size();
+#ifdef ARTIC_LS_SIMD
+    for (; i + simd::width <= n; i += simd::width) {
+        auto rest = ~simd::mask(simd::is_ident_char(simd::load(text.data() + i))) & simd::all;
+        if (rest) return i + std::countr_zero(rest);
+    }
+#endif
+    while (i < n && is_ident_char(text[i])) ++i;
+    return i;
+}
+
+// Index of the first non-whitespace byte at or after i
+static size_t skip_space(std::string_view text, size_t i) {
+    const size_t n = text.size();
+#ifdef ARTIC_LS_SIMD
+    for (; i + simd::width <= n; i += simd::width) {
+        auto rest = ~simd::mask(simd::is_space(simd::load(text.data() + i))) & simd::all;
+        if (rest) return i + std::countr_zero(rest);
+    }
+#endif
+    while (i < n && is_space(text[i])) ++i;
+    return i;
+}
+
+enum class Keyword { None, Fn, Struct, Enum, Type, Static, Mod, Use, Implicit, As, Mut };
+
+// Perfect hash over the keywords the scan cares about: (2 * first + 5 * last + length) mod 32
+static Keyword keyword(std::string_view ident) {
+    struct Entry { std::string_view name; Keyword keyword; };
+    static constexpr Entry table[32] = {
+        {}, { "mut", Keyword::Mut }, {}, { "as", Keyword::As }, {}, { "type", Keyword::Type },
+        { "use", Keyword::Use }, {}, {}, {}, {}, {}, {}, {}, {}, { "enum", Keyword::Enum },
+        { "struct", Keyword::Struct }, { "mod", Keyword::Mod }, {}, {}, { "fn", Keyword::Fn }, {},
+        {}, {}, {}, {}, {}, { "static", Keyword::Static }, {}, {}, { "implicit", Keyword::Implicit }, {},
+    };
+    if (ident.size() < 2 || ident.size() > 8) return Keyword::None;
+    auto hash = (2u * static_cast<unsigned char>(ident.front()) + 5u * static_cast<unsigned char>(ident.back()) + ident.size()) & 31;
+    return table[hash].name == ident ? table[hash].keyword : Keyword::None;
+}
+
+FileSymbols FileSymbols::scan(std::string_view text, SymbolTable& table) {
+    FileSymbols symbols;
+    size_t i = 0;
+    const size_t n = text.size();
+    int depth = 0;
+
+    // keyword at depth 0 whose next identifier is a declared name
+    auto pending_decl = Keyword::None;
+    // depth of the parentheses of a filter `fn @(...) name`
+    int filter_depth = 0;
+
+    while ((i = skip_space(text, i)) < n) {
+        char c = text[i];
+
+        // comments
+        if (c == '/' && i + 1 < n && text[i + 1] == '/') {
+            auto end = static_cast<const char*>(std::memchr(text.data() + i, '\n', n - i));
+            i = end ? end - text.data() : n;
+            continue;
+        }
+        if (c == '/' && i + 1 < n && text[i + 1] == '*') {
+            auto end = text.find("*/", i + 2);
+            i = end == std::string_view::npos ? n : end + 2;
+            continue;
+        }
+        // string and character literals
+        if (c == '"' || c == '\'') {
+            ++i;
+            while (i < n && text[i] != c) {
+                if (text[i] == '\\') ++i;
+                ++i;
+            }
+            ++i;
+            continue;
+        }
+        // numbers, including suffixes such as 1u8 that are not names
+        if (c >= '0' && c <= '9') {
+            i = scan_ident(text, i + 1);
+            continue;
+        }
+        if (is_ident_begin(c)) {
+            size_t begin = i;
+            i = scan_ident(text, i + 1);
+            auto ident = text.substr(begin, i - begin);
+            auto kw = keyword(ident);
+
+            if (kw == Keyword::Implicit) symbols.has_implicits = true;
+            if (filter_depth > 0) continue;
+
+            if (pending_decl != Keyword::None) {
+                if (kw == Keyword::Mut || kw == Keyword::As) continue; // static mut x, use a as b
+                if (pending_decl == Keyword::Use) {
+                    // use a::b::c as d; -> declares the last identifier
+                    symbols.uses.push_back(table.intern(ident));
+                    if (i < n && text.substr(i).starts_with("::")) continue;
+                    auto rest = text.substr(i);
+                    auto semi = rest.find(';');
+                    auto as = rest.substr(0, semi).find(" as ");
+                    if (as != std::string_view::npos) continue; // alias follows as the next identifier
+                }
+                symbols.declares.push_back(table.intern(ident));
+                if (pending_decl == Keyword::Struct || pending_decl == Keyword::Enum || pending_decl == Keyword::Type || pending_decl == Keyword::Mod)
+                    symbols.declared_types.push_back(symbols.declares.back());
+                pending_decl = Keyword::None;
+                continue;
+            }
+
+            if (depth == 0 && kw != Keyword::None && kw != Keyword::Implicit && kw != Keyword::As && kw != Keyword::Mut) {
+                pending_decl = kw;
+                continue;
+            }
+            if (kw != Keyword::As) symbols.uses.push_back(table.intern(ident));
+            continue;
+        }
+
+        if (c == '@' && pending_decl == Keyword::Fn && i + 1 < n && text[i + 1] == '(') {
+            filter_depth = 1;
+            i += 2;
+            continue;
+        }
+        if (filter_depth > 0) {
+            if (c == '(') ++filter_depth;
+            if (c == ')') --filter_depth;
+            ++i;
+            continue;
+        }
+
+        if (c == '{') ++depth;
+        if (c == '}') depth = std::max(0, depth - 1);
+        if (c == ';' || c == '{' || c == '(' || c == '=') pending_decl = Keyword::None;
+        ++i;
+    }
+
+    auto sort_unique = [](std::vector<Symbol>& v) {
+        std::sort(v.begin(), v.end());
+        v.erase(std::unique(v.begin(), v.end()), v.end());
+    };
+    sort_unique(symbols.declares);
+    sort_unique(symbols.uses);
+    sort_unique(symbols.declared_types);
+    return symbols;
+}
+
+// NameIndex ---------------------------------------------------------------------
+
+void NameIndex::add(File* file, const FileSymbols& symbols) {
+    if (!symbols.declares.empty() && symbols.declares.back() >= declared_in.size())
+        declared_in.resize(symbols.declares.back() + 1);
+    for (auto name : symbols.declares)
+        declared_in[name].push_back(file);
+    if (symbols.has_implicits)
+        with_implicits.push_back(file);
+}
+
+std::vector<File*> NameIndex::reachable_from(
+    File* root,
+    std::span<File* const> files,
+    const std::unordered_map<File*, FileSymbols>& symbols) const
+{
+    std::unordered_set<File*> reachable{ root };
+    std::vector<File*> stack{ root };
+    for (auto file : with_implicits) {
+        if (reachable.insert(file).second) stack.push_back(file);
+    }
+
+    while (!stack.empty()) {
+        auto file = stack.back();
+        stack.pop_back();
+        auto it = symbols.find(file);
+        if (it == symbols.end()) continue;
+        for (auto name : it->second.uses) {
+            if (name >= declared_in.size()) continue;
+            for (auto dep : declared_in[name]) {
+                if (reachable.insert(dep).second) stack.push_back(dep);
+            }
+        }
+    }
+
+    std::vector<File*> res;
+    res.reserve(reachable.size());
+    for (auto file : files) {
+        if (reachable.contains(file)) res.push_back(file);
+    }
+    return res;
+}
+
+} // namespace artic::ls::workspace
@@ -0,0 +1,125 @@
+#include "fsscan.h"
+
+#include <chrono>
+
+#if !defined(_WIN32)
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+namespace artic::ls::workspace::fsscan {
+
+#if !defined(_WIN32)
+
+static Kind kind_of(mode_t mode) {
+    if (S_ISREG(mode)) return Kind::File;
+    if (S_ISDIR(mode)) return Kind::Directory;
+    return Kind::Other;
+}
+
+bool list_dir(const fs::path& dir, std::vector<Entry>& out) {
+    DIR* d = opendir(dir.c_str());
+    if (!d) return false;
+    int fd = dirfd(d);
+
+    while (auto* e = readdir(d)) {
+        std::string_view name = e->d_name;
+        if (name == "." || name == "..") continue;
+
+        Entry entry{ .name = std::string(name) };
+        struct stat st;
+        switch (e->d_type) {
+            case DT_REG: entry.kind = Kind::File;      break;
+            case DT_DIR: entry.kind = Kind::Directory; break;
+            case DT_LNK:
+                entry.is_link = true;
+                if (fstatat(fd, e->d_name, &st, 0) == 0) entry.kind = kind_of(st.st_mode);
+                break;
+            case DT_UNKNOWN:
+                // Some file systems (e.g. older XFS, some network mounts) do not fill d_type
+                if (fstatat(fd, e->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) break;
+                if (S_ISLNK(st.st_mode)) {
+                    entry.is_link = true;
+                    if (fstatat(fd, e->d_name, &st, 0) != 0) break;
+                }
+                entry.kind = kind_of(st.st_mode);
+                break;
+            default: entry.kind = Kind::Other; break;
+        }
+        out.push_back(std::move(entry));
+    }
+    closedir(d);
+    return true;
+}
+
+Kind stat_kind(const fs::path& path, bool* is_link) {
+    struct stat st;
+    if (is_link) {
+        *is_link = false;
+        if (lstat(path.c_str(), &st) != 0) return Kind::None;
+        if (!S_ISLNK(st.st_mode)) return kind_of(st.st_mode);
+        *is_link = true;
+    }
+    if (::stat(path.c_str(), &st) != 0) return Kind::None;
+    return kind_of(st.st_mode);
+}
+
+bool stat_file(const fs::path& path, FileStat& out) {
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) return false;
+#if defined(__APPLE__)
+    const auto& mtime = st.st_mtimespec;
+#else
+    const auto& mtime = st.st_mtim;
+#endif
+    out = { static_cast<uint64_t>(st.st_size), static_cast<int64_t>(mtime.tv_sec), static_cast<uint32_t>(mtime.tv_nsec) };
+    return true;
+}
+
+#else
+
+static Kind kind_of(fs::file_status status) {
+    if (fs::is_regular_file(status)) return Kind::File;
+    if (fs::is_directory(status))    return Kind::Directory;
+    if (fs::exists(status))          return Kind::Other;
+    return Kind::None;
+}
+
+bool list_dir(const fs::path& dir, std::vector<Entry>& out) {
+    std::error_code ec;
+    auto it = fs::directory_iterator(dir, ec);
+    if (ec) return false;
+    for (; it != fs::directory_iterator(); it.increment(ec)) {
+        if (ec) break;
+        Entry entry{ .name = it->path().filename().string() };
+        entry.is_link = it->is_symlink(ec);
+        entry.kind = kind_of(it->status(ec));
+        out.push_back(std::move(entry));
+    }
+    return true;
+}
+
+Kind stat_kind(const fs::path& path, bool* is_link) {
+    std::error_code ec;
+    if (is_link) *is_link = fs::is_symlink(fs::symlink_status(path, ec));
+    return kind_of(fs::status(path, ec));
+}
+
+bool stat_file(const fs::path& path, FileStat& out) {
+    std::error_code ec;
+    if (!fs::is_regular_file(fs::status(path, ec))) return false;
+    auto size = fs::file_size(path, ec);
+    if (ec) return false;
+    auto time = fs::last_write_time(path, ec);
+    if (ec) return false;
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::clock_cast<std::chrono::system_clock>(time).time_since_epoch()).count();
+    auto sec = ns / 1000000000;
+    if (ns % 1000000000 < 0) --sec;
+    out = { size, sec, static_cast<uint32_t>(ns - sec * 1000000000) };
+    return true;
+}
+
+#endif
+
+} // namespace artic::ls::workspace::fsscan
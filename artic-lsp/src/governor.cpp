@@ -0,0 +1,187 @@
+#include "governor.h"
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <string_view>
+#if defined(ARTIC_LS_ALLOCATOR_MIMALLOC)
+#include <mimalloc.h>
+#elif defined(ARTIC_LS_ALLOCATOR_JEMALLOC)
+#include <jemalloc/jemalloc.h>
+#include <cstdio>
+#elif defined(__GLIBC__)
+#include <malloc.h>
+#endif
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
+
+namespace artic::ls::memory {
+
+std::string_view allocator_name() {
+#if defined(ARTIC_LS_ALLOCATOR_MIMALLOC)
+    return "mimalloc";
+#elif defined(ARTIC_LS_ALLOCATOR_JEMALLOC)
+    return "jemalloc";
+#elif defined(__GLIBC__)
+    return "glibc";
+#else
+    return "system";
+#endif
+}
+
+#if defined(ARTIC_LS_ALLOCATOR_JEMALLOC)
+template <typename T>
+static T jemalloc_stat(const char* name) {
+    T value{};
+    size_t size = sizeof(value);
+    if (mallctl(name, &value, &size, nullptr, 0) != 0) return T{};
+    return value;
+}
+#endif
+
+AllocatorStats allocator_stats() {
+    AllocatorStats stats;
+#if defined(ARTIC_LS_ALLOCATOR_MIMALLOC)
+    // release builds of mimalloc keep no allocation statistics, only the process counters
+    size_t elapsed, user, system, rss, peak_rss, commit, peak_commit, faults;
+    mi_process_info(&elapsed, &user, &system, &rss, &peak_rss, &commit, &peak_commit, &faults);
+    stats.held = commit;
+#elif defined(ARTIC_LS_ALLOCATOR_JEMALLOC)
+    // statistics are cached until the epoch is advanced
+    uint64_t epoch = 1;
+    size_t size = sizeof(epoch);
+    mallctl("epoch", &epoch, &size, &epoch, size);
+    stats.allocated = jemalloc_stat<size_t>("stats.allocated");
+    stats.held = jemalloc_stat<size_t>("stats.resident");
+    char name[64];
+    for (auto kind : { "small", "large" }) {
+        std::snprintf(name, sizeof(name), "stats.arenas.%u.%s.nmalloc", unsigned(MALLCTL_ARENAS_ALL), kind);
+        stats.allocations += jemalloc_stat<uint64_t>(name);
+    }
+#elif defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    auto info = mallinfo2();
+    stats.allocated = info.uordblks + info.hblkhd;
+    stats.held = info.arena + info.hblkhd;
+#endif
+    return stats;
+}
+
+size_t heap_allocated_bytes() {
+#if defined(ARTIC_LS_ALLOCATOR_MIMALLOC)
+    return allocator_stats().held;
+#else
+    return allocator_stats().allocated;
+#endif
+}
+
+size_t resident_bytes() {
+#if defined(_WIN32)
+    return 0;
+#else
+    std::ifstream is("/proc/self/statm");
+    size_t total = 0, resident = 0;
+    if (!(is >> total >> resident)) return 0;
+    return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+void trim_heap() {
+#if defined(ARTIC_LS_ALLOCATOR_MIMALLOC)
+    mi_collect(true);
+#elif defined(ARTIC_LS_ALLOCATOR_JEMALLOC)
+    char name[64];
+    std::snprintf(name, sizeof(name), "arena.%u.purge", unsigned(MALLCTL_ARENAS_ALL));
+    mallctl(name, nullptr, nullptr, nullptr, 0);
+#elif defined(__GLIBC__)
+    malloc_trim(0);
+#endif
+}
+
+#if !defined(_WIN32)
+
+// Lines "some avg10=1.23 avg60=..." and "full avg10=..." of a PSI file: share of time (in %)
+// in the last 10s in which some (or all, for "full") tasks stalled on memory.
+// False if the file does not exist, e.g. on kernels without PSI.
+static bool read_psi(const std::string& file, double& some, double& full) {
+    std::ifstream is(file);
+    if (!is) return false;
+    some = full = 0;
+    std::string line;
+    while (std::getline(is, line)) {
+        auto pos = line.find("avg10=");
+        if (pos == std::string::npos) continue;
+        if (line.starts_with("some"))      some = std::stod(line.substr(pos + 6));
+        else if (line.starts_with("full")) full = std::stod(line.substr(pos + 6));
+    }
+    return true;
+}
+
+static std::string cgroup_dir() {
+    std::ifstream is("/proc/self/cgroup");
+    std::string line;
+    while (std::getline(is, line)) {
+        // cgroup v2 entry
+        if (line.starts_with("0::")) return "/sys/fs/cgroup" + line.substr(3);
+    }
+    return {};
+}
+
+static size_t read_cgroup_value(const std::string& file) {
+    std::ifstream is(file);
+    std::string value;
+    if (!(is >> value) || value == "max") return 0;
+    return std::stoull(value);
+}
+
+// Value of a "key value" line of a cgroup file such as memory.stat, 0 if missing
+static size_t read_cgroup_key(const std::string& file, std::string_view key) {
+    std::ifstream is(file);
+    std::string name;
+    size_t value = 0;
+    while (is >> name >> value) {
+        if (name == key) return value;
+    }
+    return 0;
+}
+
+Pressure memory_pressure() {
+    auto pressure = Pressure::None;
+    try {
+        static const std::string cgroup = cgroup_dir();
+
+        // PSI thresholds in % of stalled time. /proc/pressure/memory covers the whole host,
+        // also inside a container: prefer the cgroup's own file (missing in the root cgroup)
+        double some = 0, full = 0;
+        if ((!cgroup.empty() && read_psi(cgroup + "/memory.pressure", some, full)) || read_psi("/proc/pressure/memory", some, full)) {
+            if (full >= 10.0)      pressure = Pressure::Critical;
+            else if (some >= 10.0) pressure = Pressure::Moderate;
+        }
+
+        if (!cgroup.empty()) {
+            // memory.current includes the page cache, which the kernel reclaims before hitting the limit:
+            // only count the working set, without the inactive file pages
+            auto limit = read_cgroup_value(cgroup + "/memory.max");
+            if (auto high = read_cgroup_value(cgroup + "/memory.high"); high && (!limit || high < limit)) limit = high;
+            if (limit) {
+                auto current = read_cgroup_value(cgroup + "/memory.current");
+                auto inactive_file = read_cgroup_key(cgroup + "/memory.stat", "inactive_file");
+                auto working_set = current - std::min(current, inactive_file);
+                double usage = static_cast<double>(working_set) / static_cast<double>(limit);
+                if (usage >= 0.95)     pressure = Pressure::Critical;
+                else if (usage >= 0.8) pressure = std::max(pressure, Pressure::Moderate);
+            }
+        }
+    } catch (const std::exception&) {
+        // malformed pseudo file, treat as no pressure
+    }
+    return pressure;
+}
+
+#else
+
+Pressure memory_pressure() { return Pressure::None; }
+
+#endif
+
+} // namespace artic::ls::memory
@@ -0,0 +1,291 @@
+#include "index.h"
+
+#include "compile.h"
+#include "config.h"
+#include "depgraph.h"
+#include "fsscan.h"
+#include "language.h"
+#include "workspace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <unordered_map>
+#include <unordered_set>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace artic::ls::index {
+
+// Reading ---------------------------------------------------------------------
+
+std::shared_ptr<const LibraryIndex> LibraryIndex::open(const fs::path& path, std::string& error) {
+    std::shared_ptr<LibraryIndex> index(new LibraryIndex());
+    index->path_ = path;
+
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+        auto data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            index->data_ = static_cast<const char*>(data);
+            index->size_ = st.st_size;
+            index->mapped_ = true;
+        }
+    }
+    if (fd >= 0) close(fd);
+#endif
+    if (!index->mapped_) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            error = "cannot open index " + path.generic_string();
+            return nullptr;
+        }
+        index->buffer_.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        index->data_ = index->buffer_.data();
+        index->size_ = index->buffer_.size();
+    }
+
+    if (index->size_ < sizeof(format::Header)) {
+        error = "index " + path.generic_string() + " is truncated";
+        return nullptr;
+    }
+    const auto& header = *reinterpret_cast<const format::Header*>(index->data_);
+    if (std::memcmp(header.magic, format::magic, sizeof(format::magic)) != 0) {
+        error = path.generic_string() + " is not an artic-lsp index";
+        return nullptr;
+    }
+    if (header.version != format::version) {
+        error = "index " + path.generic_string() + " has format version " + std::to_string(header.version)
+              + ", expected " + std::to_string(format::version) + " (rebuild it with artic-lsp --index)";
+        return nullptr;
+    }
+
+    // only the bounds of the tables, their entries are checked on access
+    auto table = [&]<typename T>(std::span<const T>& span, uint64_t offset, uint64_t count) {
+        if (offset % alignof(T) != 0 || offset > index->size_ || count > (index->size_ - offset) / sizeof(T)) return false;
+        span = { reinterpret_cast<const T*>(index->data_ + offset), size_t(count) };
+        return true;
+    };
+    bool valid = table(index->files_, header.files, header.num_files)
+              && table(index->decls_, header.decls, header.num_decls)
+              && table(index->symbols_, header.symbols, header.num_symbols)
+              && table(index->strings_, header.strings, header.num_strings)
+              && header.string_data <= index->size_ && header.string_bytes <= index->size_ - header.string_data;
+    if (!valid) {
+        error = "index " + path.generic_string() + " is damaged";
+        return nullptr;
+    }
+    index->string_data_ = std::string_view(index->data_ + header.string_data, header.string_bytes);
+    return index;
+}
+
+LibraryIndex::~LibraryIndex() {
+#ifndef _WIN32
+    if (mapped_) munmap(const_cast<char*>(data_), size_);
+#endif
+}
+
+bool LibraryIndex::matches(const format::FileEntry& entry, const fs::path& file, const std::string* text) const {
+    if (text) return text->size() == entry.size && hash_text(*text) == entry.hash;
+    workspace::fsscan::FileStat st;
+    if (!workspace::fsscan::stat_file(file, st) || st.size != entry.size) return false;
+    if (st.mtime_sec == entry.mtime_sec && st.mtime_nsec == entry.mtime_nsec) return true;
+    std::ifstream in(file, std::ios::binary);
+    if (!in) return false;
+    std::string contents(std::istreambuf_iterator<char>(in), {});
+    return contents.size() == entry.size && hash_text(contents) == entry.hash;
+}
+
+// Writing ---------------------------------------------------------------------
+
+namespace {
+
+class Writer {
+public:
+    Writer() { string({}); } // id 0
+
+    uint32_t string(std::string_view s) {
+        if (auto it = ids_.find(s); it != ids_.end()) return it->second;
+        auto id = static_cast<uint32_t>(strings_.size());
+        strings_.push_back({ static_cast<uint32_t>(data_.size()), static_cast<uint32_t>(s.size()) });
+        data_.append(s);
+        ids_.emplace(s, id);
+        return id;
+    }
+
+    std::vector<format::FileEntry> files;
+    std::vector<format::DeclEntry> decls;
+    std::vector<uint32_t> symbols;
+
+    bool save(const fs::path& out, std::string& error) const {
+        format::Header header{};
+        std::memcpy(header.magic, format::magic, sizeof(format::magic));
+        header.version = format::version;
+        header.num_files = static_cast<uint32_t>(files.size());
+        header.num_decls = static_cast<uint32_t>(decls.size());
+        header.num_symbols = static_cast<uint32_t>(symbols.size());
+        header.num_strings = static_cast<uint32_t>(strings_.size());
+        header.string_bytes = static_cast<uint32_t>(data_.size());
+
+        std::string bytes(sizeof(header), '\0');
+        auto append = [&](const void* data, size_t size) {
+            bytes.resize((bytes.size() + 7) & ~size_t(7), '\0');
+            auto offset = bytes.size();
+            bytes.append(static_cast<const char*>(data), size);
+            return offset;
+        };
+        header.files = append(files.data(), files.size() * sizeof(format::FileEntry));
+        header.decls = append(decls.data(), decls.size() * sizeof(format::DeclEntry));
+        header.symbols = append(symbols.data(), symbols.size() * sizeof(uint32_t));
+        header.strings = append(strings_.data(), strings_.size() * sizeof(format::String));
+        header.string_data = append(data_.data(), data_.size());
+        std::memcpy(bytes.data(), &header, sizeof(header));
+
+        // written next to the target and renamed, so that a server never maps a half-written index
+        auto tmp = out;
+        tmp += ".tmp";
+        {
+            std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+            file.write(bytes.data(), bytes.size());
+            if (!file) {
+                error = "cannot write " + tmp.generic_string();
+                return false;
+            }
+        }
+        std::error_code ec;
+        fs::rename(tmp, out, ec);
+        if (ec) error = "cannot write " + out.generic_string() + ": " + ec.message();
+        return !ec;
+    }
+
+private:
+    std::vector<format::String> strings_;
+    std::string data_;
+    // transparent, so that lookups by string_view do not build a string
+    struct StringHash {
+        using is_transparent = void;
+        size_t operator()(std::string_view s) const { return std::hash<std::string_view>()(s); }
+    };
+    std::unordered_map<std::string, uint32_t, StringHash, std::equal_to<>> ids_;
+};
+
+} // anonymous namespace
+
+bool write(const fs::path& out, const workspace::Project& project, std::span<workspace::File* const> all_files, std::string& error) {
+    std::unordered_set<fs::path> own(project.files.begin(), project.files.end());
+    std::vector<workspace::File*> files;
+    for (auto file : all_files) {
+        file->read();
+        if (own.contains(file->path)) files.push_back(file);
+    }
+    if (files.empty()) {
+        error = "project " + project.name + " has no files";
+        return false;
+    }
+
+    // types are only known after checking the files together with the dependencies
+    Compiler compiler;
+    compiler.compile_files(all_files, files.front()->path);
+    size_t errors = std::count_if(compiler.diagnostics.begin(), compiler.diagnostics.end(), [](const Diagnostic& d) { return d.severity == Diagnostic::Error; });
+    if (errors) log::info("Indexing project {} with {} compile error(s), declarations may be missing", project.name, errors);
+
+    std::unordered_map<std::string, std::vector<const ast::NamedDecl*>> decls_of;
+    if (compiler.program) {
+        for (const auto& decl : compiler.program->decls) {
+            if (auto named = decl->isa<ast::NamedDecl>(); named && named->loc.file) decls_of[*named->loc.file].push_back(named);
+        }
+    }
+
+    Writer writer;
+    workspace::SymbolTable table;
+    for (auto file : files) {
+        std::string_view text = file->text ? std::string_view(*file->text) : std::string_view();
+        auto symbols = workspace::FileSymbols::scan(text, table);
+
+        format::FileEntry entry{};
+        entry.path = writer.string(fs::relative(file->path, project.root_dir).generic_string());
+        entry.has_implicits = symbols.has_implicits;
+        entry.size = text.size();
+        entry.hash = hash_text(text);
+        if (workspace::fsscan::FileStat st; workspace::fsscan::stat_file(file->path, st)) {
+            entry.mtime_sec = st.mtime_sec;
+            entry.mtime_nsec = st.mtime_nsec;
+        }
+        entry.declares = static_cast<uint32_t>(writer.symbols.size());
+        for (auto symbol : symbols.declares) writer.symbols.push_back(writer.string(table.name(symbol)));
+        entry.uses = static_cast<uint32_t>(writer.symbols.size());
+        for (auto symbol : symbols.uses) writer.symbols.push_back(writer.string(table.name(symbol)));
+        entry.symbols_end = static_cast<uint32_t>(writer.symbols.size());
+        writer.files.push_back(entry);
+
+        for (auto decl : decls_of[file->path.generic_string()]) {
+            auto item = completion_item(*decl);
+            if (!item) continue;
+            writer.decls.push_back({
+                .name = writer.string(decl->id.name),
+                .label = writer.string(item->label),
+                .detail = writer.string(item->detail.value_or("")),
+                .insert_text = writer.string(item->insertText.value_or("")),
+                .kind = item->kind ? static_cast<uint32_t>(*item->kind) : 0,
+                .is_type = is_type_decl(*decl),
+            });
+        }
+    }
+    log::info("Indexed {} files and {} declarations of project {}", writer.files.size(), writer.decls.size(), project.name);
+    return writer.save(out, error);
+}
+
+// Command line ----------------------------------------------------------------
+
+int run(const Options& options) {
+    auto folder = fs::weakly_canonical(options.workspace);
+    if (fs::is_regular_file(folder)) folder = folder.parent_path();
+    if (!fs::is_directory(folder)) {
+        std::cerr << "artic-lsp --index: no such folder: " << options.workspace.generic_string() << "\n";
+        return 2;
+    }
+
+    workspace::Workspace workspace({ folder });
+    workspace::config::ConfigLog config_log;
+    workspace.reload(config_log);
+
+    std::vector<std::pair<const workspace::Project*, std::vector<workspace::File*>>> selected;
+    for (auto& [project, files] : workspace.all_project_files()) {
+        if (project->files.empty() || (!options.project.empty() && project->name != options.project)) continue;
+        selected.emplace_back(project, std::move(files));
+    }
+    if (selected.empty()) {
+        std::cerr << "artic-lsp --index: no projects with files" << (options.project.empty() ? "" : " named " + options.project)
+                  << " in " << folder.generic_string() << "\n";
+        return 2;
+    }
+    if (!options.output.empty() && selected.size() > 1) {
+        std::cerr << "artic-lsp --index: -o needs a single project, select one with --project\n";
+        return 2;
+    }
+
+    size_t failed = 0;
+    for (const auto& [project, files] : selected) {
+        auto out = options.output.empty() ? project->root_dir / (project->name + ".articidx") : options.output;
+        std::string error;
+        if (write(out, *project, files, error)) {
+            std::printf("%s: %s\n", project->name.c_str(), out.generic_string().c_str());
+        } else {
+            std::cerr << "artic-lsp --index: " << error << "\n";
+            ++failed;
+        }
+    }
+    return failed ? 1 : 0;
+}
+
+} // namespace artic::ls::index
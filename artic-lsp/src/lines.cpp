@@ -0,0 +1,79 @@
+#include "lines.h"
+
+#include <algorithm>
+
+namespace artic::ls {
+
+static bool is_ascii(std::string_view line) {
+    // branch free, so that the loop vectorizes
+    unsigned char bits = 0;
+    for (char c : line) bits |= static_cast<unsigned char>(c);
+    return bits < 0x80;
+}
+
+static uint32_t utf8_length(unsigned char lead) {
+    if (lead < 0x80)         return 1;
+    if ((lead >> 5) == 0x6)  return 2;
+    if ((lead >> 4) == 0xE)  return 3;
+    if ((lead >> 3) == 0x1E) return 4;
+    return 1; // invalid byte, counted as one character
+}
+
+LineIndex::LineIndex(std::string_view text) {
+    size_t begin = 0;
+    while (true) {
+        line_starts_.push_back(static_cast<uint32_t>(begin));
+        auto end = text.find('\n', begin);
+        auto line = text.substr(begin, end == std::string_view::npos ? std::string_view::npos : end - begin);
+
+        if (!is_ascii(line)) {
+            Line table{ .row = static_cast<uint32_t>(line_starts_.size()) };
+            uint32_t utf16 = 0;
+            for (size_t i = 0; i < line.size();) {
+                auto len = std::min<size_t>(utf8_length(static_cast<unsigned char>(line[i])), line.size() - i);
+                table.utf8.push_back(static_cast<uint32_t>(i));
+                table.utf16.push_back(utf16);
+                utf16 += len == 4 ? 2 : 1; // surrogate pair outside the BMP
+                i += len;
+            }
+            table.utf8.push_back(static_cast<uint32_t>(line.size()));
+            table.utf16.push_back(utf16);
+            non_ascii_lines_.push_back(std::move(table));
+        }
+
+        if (end == std::string_view::npos) break;
+        begin = end + 1;
+    }
+}
+
+const LineIndex::Line* LineIndex::non_ascii_line(uint32_t row) const {
+    auto it = std::lower_bound(non_ascii_lines_.begin(), non_ascii_lines_.end(), row,
+        [](const Line& line, uint32_t row) { return line.row < row; });
+    return it != non_ascii_lines_.end() && it->row == row ? &*it : nullptr;
+}
+
+uint32_t LineIndex::character(uint32_t row, uint32_t col, PositionEncoding encoding) const {
+    uint32_t index = col > 0 ? col - 1 : 0;
+    if (encoding == PositionEncoding::Utf32) return index;
+    auto line = non_ascii_line(row);
+    if (!line) return index;
+
+    auto& offsets = encoding == PositionEncoding::Utf8 ? line->utf8 : line->utf16;
+    // columns behind the end of the line count one unit each
+    if (index >= offsets.size()) return offsets.back() + (index - static_cast<uint32_t>(offsets.size() - 1));
+    return offsets[index];
+}
+
+uint32_t LineIndex::column(uint32_t row, uint32_t character, PositionEncoding encoding) const {
+    if (encoding == PositionEncoding::Utf32) return character + 1;
+    auto line = non_ascii_line(row);
+    if (!line) return character + 1;
+
+    auto& offsets = encoding == PositionEncoding::Utf8 ? line->utf8 : line->utf16;
+    if (character > offsets.back()) return static_cast<uint32_t>(offsets.size()) + (character - offsets.back());
+    // a character inside a code point belongs to that code point
+    auto it = std::upper_bound(offsets.begin(), offsets.end(), character);
+    return static_cast<uint32_t>(it - offsets.begin());
+}
+
+} // namespace artic::ls
@@ -1,6 +1,54 @@
 #include "server.h"
+#include "check.h"
+#include "index.h"
 
-int main() {
+#include <charconv>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+int main(int argc, char** argv) {
+    // artic-lsp --check [--jobs <n>] [--json <file>|-] <workspace folder or config>
+    if (argc > 1 && std::string(argv[1]) == "--check") {
+        artic::ls::check::Options options;
+        // a positive number, without trailing characters
+        auto parse_jobs = [](std::string_view value, unsigned& jobs) {
+            auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), jobs);
+            return ec == std::errc() && end == value.data() + value.size() && jobs > 0;
+        };
+        for (int i = 2; i < argc; ++i) {
+            std::string arg = argv[i];
+            if      (arg == "--jobs" && i + 1 < argc && parse_jobs(argv[i + 1], options.jobs)) ++i;
+            else if (arg == "--json" && i + 1 < argc) options.json_file = argv[++i];
+            else if (arg != "--jobs" && options.workspace.empty()) options.workspace = arg;
+            else {
+                std::cerr << "usage: " << argv[0] << " --check [--jobs <n>] [--json <file>|-] [<workspace folder or config>]\n";
+                return 2;
+            }
+        }
+        if (options.workspace.empty()) options.workspace = ".";
+        return artic::ls::check::run(options);
+    }
+
+    // artic-lsp --index [--project <name>] [-o <file>] <workspace folder or config>
+    if (argc > 1 && std::string(argv[1]) == "--index") {
+        artic::ls::index::Options options;
+        for (int i = 2; i < argc; ++i) {
+            std::string arg = argv[i];
+            if      (arg == "--project" && i + 1 < argc) options.project = argv[++i];
+            else if (arg == "-o" && i + 1 < argc)        options.output = argv[++i];
+            else if (options.workspace.empty())          options.workspace = arg;
+            else {
+                std::cerr << "usage: " << argv[0] << " --index [--project <name>] [-o <file>] [<workspace folder or config>]\n";
+                return 2;
+            }
+        }
+        if (options.workspace.empty()) options.workspace = ".";
+        return artic::ls::index::run(options);
+    }
+
+    // isolated compiles are forked by a process that has no threads, unlike the server once it runs
+    artic::ls::crash::start_worker_host(artic::ls::Server::compile_worker_request);
     artic::ls::Server server;
     return server.run();
-}
\ No newline at end of file
+}
@@ -0,0 +1,137 @@
+#include "namemap.h"
+
+#include <algorithm>
+#include <tuple>
+
+namespace artic::ls {
+
+static FlatNameMap::Span span_of(const Loc& loc) {
+    return FlatNameMap::Span {
+        .begin_row = static_cast<uint32_t>(loc.begin.row), .begin_col = static_cast<uint32_t>(loc.begin.col),
+        .end_row   = static_cast<uint32_t>(loc.end.row),   .end_col   = static_cast<uint32_t>(loc.end.col),
+    };
+}
+
+static bool begins_before(const FlatNameMap::Span& a, const FlatNameMap::Span& b) {
+    return std::tie(a.begin_row, a.begin_col) < std::tie(b.begin_row, b.begin_col);
+}
+
+FlatNameMap::FileId FlatNameMap::file_id(const std::string& file) {
+    auto [it, inserted] = file_ids_.emplace(file, static_cast<FileId>(paths_.size()));
+    if (inserted) paths_.push_back(file);
+    return it->second;
+}
+
+FlatNameMap::DeclId FlatNameMap::decl_id(const ast::NamedDecl* decl, FileId file, const Span& span) {
+    auto [it, inserted] = decl_ids_.emplace(decl, static_cast<DeclId>(decls_.size()));
+    if (inserted) {
+        decls_.push_back(decl);
+        decl_files_.push_back(file);
+        decl_spans_.push_back(span);
+    }
+    return it->second;
+}
+
+void FlatNameMap::build(const NameMap& name_map, const Relocations& relocations) {
+    *this = {};
+
+    struct Entry {
+        FileId file;
+        Span span;
+        DeclId decl;
+        uint8_t is_decl;
+    };
+    std::vector<Entry> entries;
+    std::vector<Entry> refs;
+
+    // File and span of loc in the files the client knows, nullopt if it is inside of an edit
+    auto place = [&](const Loc& loc) -> std::optional<std::pair<FileId, Span>> {
+        if (!loc.file) return std::pair{ file_id({}), span_of(loc) };
+        auto relocation = relocations.empty() ? relocations.end() : relocations.find(*loc.file);
+        if (relocation == relocations.end()) return std::pair{ file_id(*loc.file), span_of(loc) };
+        auto span = span_of(loc);
+        auto begin_row = relocation->second.row(span.begin_row), end_row = relocation->second.row(span.end_row);
+        if (!begin_row || !end_row) return std::nullopt;
+        span.begin_row = *begin_row;
+        span.end_row = *end_row;
+        return std::pair{ file_id(relocation->second.file), span };
+    };
+    auto declared = [&](const ast::NamedDecl* decl) -> std::optional<DeclId> {
+        if (auto it = decl_ids_.find(decl); it != decl_ids_.end()) return it->second;
+        auto at = place(decl->id.loc);
+        if (!at) return std::nullopt;
+        return decl_id(decl, at->first, at->second);
+    };
+
+    for (const auto& [file, names] : name_map.files) {
+        if (!relocations.contains(file)) file_id(file);
+        for (const auto& [ref, decl] : names.declaration_of) {
+            if (!decl) continue;
+            auto at = place(name_map.get_identifier(ref).loc);
+            auto id = at ? declared(decl) : std::nullopt;
+            if (!id) continue;
+            auto entry = Entry{ at->first, at->second, *id, 0 };
+            entries.push_back(entry);
+            refs.push_back(entry);
+        }
+        for (const auto& [decl, _] : names.references_of) {
+            auto at = place(decl->id.loc);
+            auto id = at ? declared(decl) : std::nullopt;
+            if (id) entries.push_back(Entry{ at->first, at->second, *id, 1 });
+        }
+    }
+
+    // Occurrences per file
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        if (a.file != b.file) return a.file < b.file;
+        return begins_before(a.span, b.span);
+    });
+    files_.resize(paths_.size());
+    for (const auto& e : entries) {
+        auto& names = files_[e.file];
+        names.spans.push_back(e.span);
+        names.decls.push_back(e.decl);
+        names.is_decl.push_back(e.is_decl);
+    }
+
+    // References per declaration
+    std::sort(refs.begin(), refs.end(), [](const Entry& a, const Entry& b) {
+        if (a.decl != b.decl) return a.decl < b.decl;
+        if (a.file != b.file) return a.file < b.file;
+        return begins_before(a.span, b.span);
+    });
+    ref_offsets_.assign(decls_.size() + 1, 0);
+    for (const auto& r : refs) ++ref_offsets_[r.decl + 1];
+    for (size_t i = 1; i < ref_offsets_.size(); ++i) ref_offsets_[i] += ref_offsets_[i - 1];
+    ref_files_.reserve(refs.size());
+    ref_spans_.reserve(refs.size());
+    for (const auto& r : refs) {
+        ref_files_.push_back(r.file);
+        ref_spans_.push_back(r.span);
+    }
+}
+
+std::pair<size_t, size_t> FlatNameMap::FileNames::rows(uint32_t start_row, uint32_t end_row) const {
+    auto begin = std::partition_point(spans.begin(), spans.end(), [&](const Span& s) { return s.begin_row < start_row; });
+    auto end   = std::partition_point(begin, spans.end(),         [&](const Span& s) { return s.begin_row <= end_row; });
+    return { static_cast<size_t>(begin - spans.begin()), static_cast<size_t>(end - spans.begin()) };
+}
+
+std::optional<FlatNameMap::Occurrence> FlatNameMap::find_at(const Loc& cursor) const {
+    if (!cursor.file) return std::nullopt;
+    auto names = file_names(*cursor.file);
+    if (!names) return std::nullopt;
+
+    auto pos = span_of(cursor);
+    // last occurrence beginning at or before the cursor
+    auto it = std::upper_bound(names->spans.begin(), names->spans.end(), pos, begins_before);
+    if (it == names->spans.begin()) return std::nullopt;
+    --it;
+    // the cursor may also be right behind the name
+    if (std::tie(pos.begin_row, pos.begin_col) > std::tie(it->end_row, it->end_col)) return std::nullopt;
+
+    auto i = static_cast<size_t>(it - names->spans.begin());
+    return Occurrence{ .decl = names->decls[i], .is_decl = names->is_decl[i] != 0, .span = *it };
+}
+
+} // namespace artic::ls
@@ -3,6 +3,9 @@
 #include "compile.h"
 #include "config.h"
 #include "crash.h"
+#include "language.h"
+#include "scopes.h"
+#include "visit.h"
 #include "workspace.h"
 #include "artic/log.h"
 #include "artic/ast.h"
@@ -18,9 +21,14 @@
 #include <lsp/io/standardio.h>
 #include <lsp/messages.h>
 #include <lsp/jsonrpc/jsonrpc.h>
+#include <nlohmann/json.hpp>
 
+#include <cstring>
+#include <exception>
 #include <fstream>
+#include <future>
 #include <stdexcept>
+#include <unordered_set>
 #include <string>
 #include <string_view>
 #include <cctype>
@@ -35,12 +43,38 @@ namespace artic::ls {
 
 // Server ---------------------------------------------------------------------
 
-Server::Server() 
-    : connection_(lsp::Connection(lsp::io::standardIO()))
+// Close to the exec of the process, static initialization runs before main
+static const auto process_start = std::chrono::steady_clock::now();
+
+Server::Server()
+    : Server(lsp::io::standardIO())
+{}
+
+Server::Server(lsp::io::Stream& stream)
+    : connection_(lsp::Connection(stream))
     , message_handler_(this->connection_)
 {
     crash::setup_crash_handler();
     setup_events();
+    mark_startup("server constructed");
+}
+
+void Server::mark_startup(std::string_view stage) {
+    if (startup_done_) return;
+    for (const auto& [name, _] : startup_stages_) if (name == stage) return;
+    auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - process_start).count();
+    log::info("Startup: {} after {} ms", stage, static_cast<int64_t>(ms));
+    startup_stages_.emplace_back(stage, ms);
+    startup_done_ = stage == "first diagnostics";
+}
+
+workspace::Workspace& Server::workspace() {
+    if (workspace_loading_.valid()) {
+        auto log = workspace_loading_.get();
+        mark_startup("workspace loaded");
+        publish_config_diagnostics(log);
+    }
+    return *workspace_;
 }
 
 Server::~Server() = default;
@@ -79,34 +113,69 @@ Server::FileType Server::get_file_type(const fs::path& file) {
     return ext == ".json" || ext == ".artic-lsp" || ext == ".ninja" || ext == ".vcxproj" ? FileType::ConfigFile : FileType::SourceFile;
 }
 
-static lsp::Location convert_loc(const Loc& loc){
+static fs::path absolute_path(std::string_view path) {
+    return fs::weakly_canonical(fs::path(path));
+}
+
+lsp::Position Server::to_position(const std::string& file, int row, int col) const {
+    auto line = static_cast<uint32_t>(row - 1);
+    auto lines = compile ? compile->lines(file) : nullptr;
+    if (!lines) return lsp::Position { line, static_cast<lsp::uint>(col - 1) };
+    return lsp::Position { line, lines->character(static_cast<uint32_t>(row), static_cast<uint32_t>(col), position_encoding_) };
+}
+
+Loc::Pos Server::from_position(const std::string& file, const lsp::Position& pos) const {
+    auto lines = compile ? compile->lines(file) : nullptr;
+    auto col = lines ? lines->column(pos.line + 1, pos.character, position_encoding_) : pos.character + 1;
+    return Loc::Pos { .row = static_cast<int>(pos.line + 1), .col = static_cast<int>(col) };
+}
+
+static CompactLoc compact_loc(Server& server, const Loc& loc) {
     if (!loc.file) throw lsp::RequestError(lsp::Error::InternalError, "Cannot convert location with undefined file");
-    return lsp::Location {
-        .uri = lsp::FileUri::fromPath(*loc.file),
-        .range = lsp::Range {
-            .start = lsp::Position { static_cast<lsp::uint>(loc.begin.row - 1), static_cast<lsp::uint>(loc.begin.col - 1) },
-            .end   = lsp::Position { static_cast<lsp::uint>(loc.end.row   - 1), static_cast<lsp::uint>(loc.end.col   - 1) }
-        }
+    auto begin = server.to_position(*loc.file, loc.begin.row, loc.begin.col);
+    auto end   = server.to_position(*loc.file, loc.end.row,   loc.end.col);
+    return CompactLoc {
+        .file = server.file_table_.intern(*loc.file),
+        .begin_row = begin.line, .begin_col = begin.character,
+        .end_row   = end.line,   .end_col   = end.character,
     };
 }
 
-static fs::path absolute_path(std::string_view path) {
-    return fs::weakly_canonical(fs::path(path));
+static CompactLoc compact_loc(Server& server, const std::string& file, const FlatNameMap::Span& span) {
+    auto begin = server.to_position(file, span.begin_row, span.begin_col);
+    auto end   = server.to_position(file, span.end_row,   span.end_col);
+    return CompactLoc {
+        .file = server.file_table_.intern(file),
+        .begin_row = begin.line, .begin_col = begin.character,
+        .end_row   = end.line,   .end_col   = end.character,
+    };
+}
+
+static lsp::Range convert_range(const CompactLoc& loc) {
+    return lsp::Range {
+        .start = lsp::Position { loc.begin_row, loc.begin_col },
+        .end   = lsp::Position { loc.end_row,   loc.end_col   }
+    };
+}
+
+static lsp::Location convert_loc(FileTable& files, const CompactLoc& loc) {
+    return lsp::Location { .uri = files.uri(loc.file), .range = convert_range(loc) };
+}
+
+static lsp::Location convert_loc(Server& server, const Loc& loc) {
+    return convert_loc(server.file_table_, compact_loc(server, loc));
 }
 
-static Loc convert_loc(const lsp::TextDocumentIdentifier& file, const lsp::Position& pos) {
-    return Loc(
-        std::make_shared<std::string>(absolute_path(file.uri.path()).generic_string()),
-        Loc::Pos { .row = static_cast<int>(pos.line + 1), .col = static_cast<int>(pos.character + 1) }
-    );
+static Loc convert_loc(Server& server, const lsp::TextDocumentIdentifier& file, const lsp::Position& pos) {
+    auto& files = server.file_table_;
+    auto& path = files.path(files.from_uri(file.uri.path()));
+    return Loc(path, server.from_position(*path, pos));
 }
 
-static Loc convert_loc(const lsp::TextDocumentIdentifier& file, const lsp::Range& pos) {
-    return Loc(
-        std::make_shared<std::string>(absolute_path(file.uri.path()).generic_string()),
-        Loc::Pos { .row = static_cast<int>(pos.start.line + 1), .col = static_cast<int>(pos.start.character + 1) },
-        Loc::Pos { .row = static_cast<int>(pos.end.line + 1),   .col = static_cast<int>(pos.end.character + 1) }
-    );
+static Loc convert_loc(Server& server, const lsp::TextDocumentIdentifier& file, const lsp::Range& pos) {
+    auto& files = server.file_table_;
+    auto& path = files.path(files.from_uri(file.uri.path()));
+    return Loc(path, server.from_position(*path, pos.start), server.from_position(*path, pos.end));
 }
 
 
@@ -121,6 +190,10 @@ static Loc convert_loc(const lsp::TextDocumentIdentifier& file, const lsp::Range
 
 struct InitOptions {
     bool restart_from_crash = false;
+    bool isolate_compiles = false;
+    size_t memory_budget_mb = 0;
+    std::optional<double> compile_budget_ms;
+    std::vector<fs::path> workspace_folders;
 };
 
 InitOptions parse_initialize_options(const reqst::Initialize::Params& params, Server& server) {
@@ -131,24 +204,66 @@ InitOptions parse_initialize_options(const reqst::Initialize::Params& params, Se
         
         if (auto val = obj.find("restartFromCrash"); val && val->isBoolean())
             data.restart_from_crash = val->boolean();
+        if (auto val = obj.find("isolateCompiles"); val && val->isBoolean())
+            data.isolate_compiles = val->boolean();
+        if (auto val = obj.find("memoryBudgetMB"); val && val->isNumber())
+            data.memory_budget_mb = static_cast<size_t>(std::max(0.0, val->number()));
+        if (auto val = obj.find("compileBudgetMs"); val && val->isNumber())
+            data.compile_budget_ms = std::max(0.0, val->number());
+    }
+
+    if (params.workspaceFolders.has_value() && !params.workspaceFolders->isNull()) {
+        for (const auto& folder : params.workspaceFolders->value())
+            data.workspace_folders.push_back(absolute_path(folder.uri.path()));
+    } else if (!params.rootUri.isNull()) {
+        data.workspace_folders.push_back(absolute_path(params.rootUri.value().path()));
     }
     // server.send_message("No initialization options provided in initialize request", lsp::MessageType::Error);
     // workspace_root = std::string(params.rootUri.value().path());
     return data;
 }
 
+// UTF-32 counts code points like artic's columns, so it never needs conversion; UTF-8 and
+// UTF-16 (the default every client supports) only do on lines with non-ASCII characters
+static PositionEncoding negotiate_position_encoding(const reqst::Initialize::Params& params) {
+    auto res = PositionEncoding::Utf16;
+    const auto& general = params.capabilities.general;
+    if (!general || !general->positionEncodings) return res;
+    for (const auto& kind : *general->positionEncodings) {
+        if (kind == lsp::PositionEncodingKindEnum(lsp::PositionEncodingKind::UTF32)) return PositionEncoding::Utf32;
+        if (kind == lsp::PositionEncodingKindEnum(lsp::PositionEncodingKind::UTF8))  res = PositionEncoding::Utf8;
+    }
+    return res;
+}
+
+static lsp::PositionEncodingKindEnum convert_encoding(PositionEncoding encoding) {
+    switch (encoding) {
+        case PositionEncoding::Utf8:  return lsp::PositionEncodingKindEnum(lsp::PositionEncodingKind::UTF8);
+        case PositionEncoding::Utf32: return lsp::PositionEncodingKindEnum(lsp::PositionEncodingKind::UTF32);
+        default:                      return lsp::PositionEncodingKindEnum(lsp::PositionEncodingKind::UTF16);
+    }
+}
+
 void Server::setup_events_initialization() {
     message_handler_.add<reqst::Initialize>([this](reqst::Initialize::Params&& params) -> reqst::Initialize::Result {
         Timer _("Initialize");
         log::info( "\n[LSP] <<< Initialize");
+        mark_startup("initialize");
         
         InitOptions init_data = parse_initialize_options(params, *this);
 
         safe_mode_ = init_data.restart_from_crash;
-        workspace_ = std::make_unique<workspace::Workspace>();
+        isolate_compiles_ = init_data.isolate_compiles;
+        memory_.budget = init_data.memory_budget_mb * 1024 * 1024;
+        if (init_data.compile_budget_ms)
+            compile_budget_ = std::chrono::milliseconds(static_cast<int64_t>(*init_data.compile_budget_ms));
+        position_encoding_ = negotiate_position_encoding(params);
+        // configs of the workspace folders are discovered on Initialized
+        workspace_ = std::make_unique<workspace::Workspace>(std::move(init_data.workspace_folders));
         
         return reqst::Initialize::Result {
             .capabilities = lsp::ServerCapabilities{
+                .positionEncoding = convert_encoding(position_encoding_),
                 .textDocumentSync = lsp::TextDocumentSyncOptions{
                     .openClose = true,
                     .change    = lsp::TextDocumentSyncKind::Full,
@@ -183,6 +298,12 @@ void Server::setup_events_initialization() {
                 },
                 .inlayHintProvider = lsp::InlayHintOptions {
                     .resolveProvider = false
+                },
+                .workspace = lsp::ServerCapabilitiesWorkspace {
+                    .workspaceFolders = lsp::WorkspaceFoldersServerCapabilities {
+                        .supported = true,
+                        .changeNotifications = true
+                    }
                 }
             },
             .serverInfo = lsp::InitializeResultServerInfo {
@@ -194,7 +315,15 @@ void Server::setup_events_initialization() {
 
     message_handler_.add<notif::Initialized>([this](notif::Initialized::Params&&){
         log::info("\n[LSP] <<< Initialized");
-        reload_workspace();
+        mark_startup("initialized");
+        // Discovering the configs walks the workspace folders and the compiler state is built from scratch:
+        // both happen in the background, the first message that needs the workspace waits for it (see workspace())
+        workspace_loading_ = std::async(std::launch::async, [this] {
+            workspace::config::ConfigLog log;
+            workspace_->reload(log);
+            spare_compiler_ = std::make_shared<Compiler>();
+            return log;
+        });
     });
 
     message_handler_.add<reqst::Shutdown>([this]() {
@@ -218,23 +347,31 @@ void Server::setup_events_modifications() {
 
     // Textdocument ----------------------------------------------------------------------
 
-    message_handler_.add<notif::TextDocument_DidClose>([](notif::TextDocument_DidClose::Params&& params) {
+    message_handler_.add<notif::TextDocument_DidClose>([this](notif::TextDocument_DidClose::Params&& params) {
         log::info("\n[LSP] <<< TextDocument DidClose");
+        auto path = absolute_path(params.textDocument.uri.path());
+        if(get_file_type(path) != FileType::SourceFile) return;
+        // unsaved changes are discarded by the client, the file on disk is authoritative again
+        workspace().set_file_open(path, false);
+        workspace().mark_file_dirty(path);
     });
     message_handler_.add<notif::TextDocument_DidOpen>([this](notif::TextDocument_DidOpen::Params&& params) {
+        Timer _("TextDocument_DidOpen");
         log::info("\n[LSP] <<< TextDocument DidOpen");
         auto path = absolute_path(params.textDocument.uri.path());
 
         if(get_file_type(path) == FileType::SourceFile) {
+            workspace().set_file_open(path, true);
             ensure_compile(path.string());
         } else {
             workspace::config::ConfigLog log{};
-            bool known = workspace_->on_config_changed(path, log);
+            bool known = workspace().on_config_changed(path, log);
             if(known) compile.reset();
             publish_config_diagnostics(log);
         }
     });
     message_handler_.add<notif::TextDocument_DidChange>([this](notif::TextDocument_DidChange::Params&& params) {
+        Timer _("TextDocument_DidChange");
         log::info("");
         log::info("--------------------------------");
         log::info("[LSP] <<< TextDocument DidChange");
@@ -256,11 +393,13 @@ void Server::setup_events_modifications() {
         std::filesystem::path file = absolute_path(params.textDocument.uri.path());
         if(get_file_type(file) == FileType::ConfigFile) {
             workspace::config::ConfigLog log{};
-            bool known = workspace_->on_config_changed(file, log);
+            bool known = workspace().on_config_changed(file, log);
             if(known) compile.reset();
             publish_config_diagnostics(log);
             return;
         }
+        // Full compile to update the diagnostics of the whole project
+        if(prune_unreachable_files_) compile_this_and_related_files(file, nullptr, true);
     });
 
     // Workspace ----------------------------------------------------------------------
@@ -270,6 +409,22 @@ void Server::setup_events_modifications() {
         // Optionally, could inspect params.settings to override paths.
         reload_workspace();
     });
+    message_handler_.add<notif::Workspace_DidChangeWorkspaceFolders>([this](notif::Workspace_DidChangeWorkspaceFolders::Params&& params) {
+        log::info("\n[LSP] <<< Workspace DidChangeWorkspaceFolders");
+        workspace::config::ConfigLog log{};
+        for (const auto& folder : params.event.removed) {
+            workspace().remove_folder(absolute_path(folder.uri.path()), log);
+        }
+        std::vector<fs::path> added;
+        for (const auto& folder : params.event.added) {
+            added.push_back(absolute_path(folder.uri.path()));
+        }
+        workspace().add_folders(added, log);
+        publish_config_diagnostics(log);
+
+        // Project membership of the active file may have changed
+        if (compile) compile_this_and_related_files(compile->active_file);
+    });
     message_handler_.add<notif::Workspace_DidChangeWatchedFiles>([this](notif::Workspace_DidChangeWatchedFiles::Params&& params) {
         for(auto& change : params.changes) {
             auto path = absolute_path(change.uri.path());
@@ -305,11 +460,11 @@ struct SemanticToken {
     uint32_t modifiers;
 };
 
-SemanticToken create_semantic_token(const Loc& loc, const ast::NamedDecl& decl, bool is_decl) {
+SemanticToken create_semantic_token(const FlatNameMap::Span& loc, const ast::NamedDecl& decl, bool is_decl) {
     SemanticToken token {
-        .line =   (uint32_t) loc.begin.row - 1,
-        .start =  (uint32_t) loc.begin.col - 1,
-        .length = (uint32_t) loc.end.col - loc.begin.col,
+        .line =   loc.begin_row - 1,
+        .start =  loc.begin_col - 1,
+        .length = loc.end_col - loc.begin_col,
         .type = 0,
         .modifiers = 0,
     };
@@ -321,29 +476,32 @@ SemanticToken create_semantic_token(const Loc& loc, const ast::NamedDecl& decl,
         return 1u << (val);
     };
 
-    if (auto t = decl.isa<ast::StaticDecl>()) {
-        token.type = (uint32_t) ty::Variable;
-        token.modifiers |= flag(md::Static);
-        if(!t->is_mut) token.modifiers |= flag(md::Readonly);
-    } 
-    else if (auto t = decl.isa<ast::LetDecl>()) {
-        if(auto p = t->ptrn->isa<ast::PtrnDecl>()){
+    switch (classify<ast::StaticDecl, ast::LetDecl, ast::PtrnDecl, ast::TypeParam, ast::FnDecl, ast::RecordDecl,
+                     ast::EnumDecl, ast::TypeDecl, ast::FieldDecl, ast::ModDecl, ast::UseDecl>(decl)) {
+        case 0:
             token.type = (uint32_t) ty::Variable;
-            if(!p->is_mut) token.modifiers |= flag(md::Readonly);
-        }
-    } 
-    else if (auto t = decl.isa<ast::PtrnDecl>()) {
-        token.type = (uint32_t) ty::Parameter;
-        if(!t->is_mut) token.modifiers |= flag(md::Readonly);
-    } 
-    else if (decl.isa<ast::TypeParam>())  token.type = (uint32_t) ty::Type;
-    else if (decl.isa<ast::FnDecl>())     token.type = (uint32_t) ty::Function;
-    else if (decl.isa<ast::RecordDecl>()) token.type = (uint32_t) ty::Struct;
-    else if (decl.isa<ast::EnumDecl>())   token.type = (uint32_t) ty::Enum;
-    else if (decl.isa<ast::TypeDecl>())   token.type = (uint32_t) ty::Type;
-    else if (decl.isa<ast::FieldDecl>())  token.type = (uint32_t) ty::Property;
-    else if (decl.isa<ast::ModDecl>())    token.type = (uint32_t) ty::Namespace;
-    else if (decl.isa<ast::UseDecl>())    token.type = (uint32_t) ty::Namespace;
+            token.modifiers |= flag(md::Static);
+            if(!decl.isa<ast::StaticDecl>()->is_mut) token.modifiers |= flag(md::Readonly);
+            break;
+        case 1:
+            if(auto p = decl.isa<ast::LetDecl>()->ptrn->isa<ast::PtrnDecl>()){
+                token.type = (uint32_t) ty::Variable;
+                if(!p->is_mut) token.modifiers |= flag(md::Readonly);
+            }
+            break;
+        case 2:
+            token.type = (uint32_t) ty::Parameter;
+            if(!decl.isa<ast::PtrnDecl>()->is_mut) token.modifiers |= flag(md::Readonly);
+            break;
+        case 3:  token.type = (uint32_t) ty::Type;      break;
+        case 4:  token.type = (uint32_t) ty::Function;  break;
+        case 5:  token.type = (uint32_t) ty::Struct;    break;
+        case 6:  token.type = (uint32_t) ty::Enum;      break;
+        case 7:  token.type = (uint32_t) ty::Type;      break;
+        case 8:  token.type = (uint32_t) ty::Property;  break;
+        case 9:  token.type = (uint32_t) ty::Namespace; break;
+        case 10: token.type = (uint32_t) ty::Namespace; break;
+    }
 
     if(is_decl){
         token.modifiers |= flag(md::Definition);
@@ -362,37 +520,32 @@ SemanticToken create_semantic_token(const Loc& loc, const ast::NamedDecl& decl,
     return token;
 }
 
-// Collect semantic tokens from the NameMap by iterating over declarations and references
+// Collect semantic tokens from the (flat) NameMap, whose occurrences are already sorted by position
 lsp::SemanticTokens collect(
-    const ls::NameMap& name_map, 
+    const FlatNameMap& name_map, 
+    const LineIndex* lines,
+    PositionEncoding encoding,
     const std::string& file, 
-    int start_row = 0, 
-    int end_row = std::numeric_limits<int>::max()
+    int start_row, 
+    int end_row
 ) {
-    std::vector<SemanticToken> tokens;
+    auto names = name_map.file_names(file);
     // Check if we have entries for this file
-    if (!name_map.files.contains(file)) return {};
-    
-    auto& names = name_map.files.at(file);
-    
-    // Collect tokens from references (this is where we want semantic highlighting)
-    for (const auto& [ref, decl] : names.declaration_of) {
-        auto& loc = name_map.get_identifier(ref).loc;
-        if(loc.begin.row >= start_row && loc.end.row <= end_row)
-            tokens.push_back(create_semantic_token(loc, *decl, false));
-    }
-    
-    // Collect tokens from declarations
-    for (const auto& [decl, refs] : names.references_of) {
-        auto& loc = decl->id.loc;
-        if(loc.begin.row >= start_row && loc.end.row <= end_row)
-            tokens.push_back(create_semantic_token(loc, *decl, true));
-    }
+    if (!names) return {};
 
-    std::sort(tokens.begin(), tokens.end(), [](const SemanticToken& a, const SemanticToken& b) {
-        if (a.line != b.line) return a.line < b.line;
-        return a.start < b.start;
-    });
+    // References (this is where we want semantic highlighting) and declarations
+    std::vector<SemanticToken> tokens;
+    auto [begin, end] = names->rows(static_cast<uint32_t>(start_row), static_cast<uint32_t>(end_row));
+    tokens.reserve(end - begin);
+    for (size_t i = begin; i < end; ++i) {
+        const auto& loc = names->spans[i];
+        if(loc.end_row > static_cast<uint32_t>(end_row)) continue;
+        auto& token = tokens.emplace_back(create_semantic_token(loc, *name_map.decl(names->decls[i]), names->is_decl[i]));
+        if(lines) {
+            token.start  = lines->character(loc.begin_row, loc.begin_col, encoding);
+            token.length = lines->character(loc.end_row, loc.end_col, encoding) - token.start;
+        }
+    }
 
     // Encode
     std::vector<uint32_t> data;
@@ -430,7 +583,7 @@ void Server::setup_events_tokens() {
         // semantic tokens are not allowed to trigger recompile as this is called right after document changed
         bool already_compiled = compile && compile->locator.data(file.generic_string());
         if(!already_compiled) return nullptr;
-        auto tokens = collect(compile->name_map, file.generic_string());
+        auto tokens = collect(compile->flat_names(), compile->lines(file.generic_string()), position_encoding_, file.generic_string());
         
         log::info("[LSP] >>> Returning {} semantic tokens", tokens.data.size());
         return tokens;
@@ -447,7 +600,7 @@ void Server::setup_events_tokens() {
         bool already_compiled = compile && compile->locator.data(file.generic_string());
         if(!already_compiled) return nullptr;
         auto tokens = collect(
-            compile->name_map, file.generic_string(), 
+            compile->flat_names(), compile->lines(file.generic_string()), position_encoding_, file.generic_string(), 
             params.range.start.line + 1, 
             params.range.end.line + 1);
         
@@ -465,81 +618,74 @@ void Server::setup_events_tokens() {
 //
 // -----------------------------------------------------------------------------
 
-struct IndentifierOccurences{
-    std::string name;
-    std::vector<lsp::Location> all_occurences;
-
-    // Additional info
-    lsp::Location cursor_range;
-    lsp::Location declaration_range;
-};
-
 std::optional<IndentifierOccurences> find_occurrences_of_identifier(Server& server, const Loc& cursor, bool include_declaration) {
     if(Server::get_file_type(*cursor.file) != Server::FileType::SourceFile) return std::nullopt;
-    server.ensure_compile(*cursor.file);
-    auto& name_map = server.compile->name_map;
-
-    Loc cursor_range;
-    const ast::NamedDecl* target_decl = name_map.find_decl_at(cursor);
-    if(target_decl) {
-        cursor_range = target_decl->id.loc;
-        log::info("found declaration at cursor '{}'", target_decl->id.name);
-    } else {
-        if(auto ref = name_map.find_ref_at(cursor)) {
-            auto id = name_map.get_identifier(*ref);
-            cursor_range = id.loc;
-            target_decl = name_map.find_decl(*ref);
-            log::info("found reference at cursor '{}'", target_decl->id.name);
-        }
-    }
+    // references may be in files the cursor file cannot reach
+    server.ensure_compile(*cursor.file, true);
+    auto& names = server.compile->flat_names();
+
+    auto occurrence = names.find_at(cursor);
     // No symbol at cursor position
-    if(!target_decl) return std::nullopt;
+    if(!occurrence) return std::nullopt;
+    auto target = occurrence->decl;
+    const ast::NamedDecl* target_decl = names.decl(target);
+    log::info("found {} at cursor '{}'", occurrence->is_decl ? "declaration" : "reference", target_decl->id.name);
 
-    std::vector<lsp::Location> locations;
+    auto compact = [&](const std::string& file, const FlatNameMap::Span& span) { return compact_loc(server, file, span); };
+    auto declaration_range = compact(names.path(names.decl_file(target)), names.decl_span(target));
+
+    auto ref_files = names.ref_files(target);
+    auto ref_spans = names.ref_spans(target);
+    std::vector<CompactLoc> locations;
+    locations.reserve(ref_files.size() + 1);
 
     // Include the declaration itself if requested
     if (include_declaration) {
-        locations.push_back(convert_loc(target_decl->id.loc));
+        locations.push_back(declaration_range);
     }
 
-    // Find all references to this declaration
-    for (auto ref : name_map.find_refs(target_decl)) {
-        locations.push_back(convert_loc(name_map.get_identifier(ref).loc));
+    // All references to this declaration, contiguous and grouped by file
+    for (size_t i = 0; i < ref_files.size(); ++i) {
+        locations.push_back(compact(names.path(ref_files[i]), ref_spans[i]));
     }
 
     return IndentifierOccurences {
         .name = target_decl->id.name,
         .all_occurences = std::move(locations),
-        .cursor_range = convert_loc(cursor_range),
-        .declaration_range = convert_loc(target_decl->id.loc),
+        .cursor_range = compact(*cursor.file, occurrence->span),
+        .declaration_range = declaration_range,
     };
 }
 
+static std::vector<lsp::Location> to_locations(FileTable& files, std::span<const CompactLoc> locs) {
+    std::vector<lsp::Location> res;
+    res.reserve(locs.size());
+    for (auto& loc : locs) res.push_back(convert_loc(files, loc));
+    return res;
+}
+
 void Server::setup_events_definitions() {
     message_handler_.add<reqst::TextDocument_Definition>([this](lsp::TextDocumentPositionParams&& pos) -> reqst::TextDocument_Definition::Result {
         Timer _("TextDocument_Definition");
         log::info("\n[LSP] <<< TextDocument Definition {}:{}:{}", pos.textDocument.uri.path(), pos.position.line + 1, pos.position.character + 1);
 
-        auto cursor = convert_loc(pos.textDocument, pos.position);
-
         if(get_file_type(pos.textDocument.uri.path()) != FileType::SourceFile) return nullptr;
         ensure_compile(pos.textDocument.uri.path());
-        auto& name_map = compile->name_map;
+        auto cursor = convert_loc(*this, pos.textDocument, pos.position);
+        auto& names = compile->flat_names();
         
         // When on a reference try find declaration
-        if(auto ref = name_map.find_ref_at(cursor)) {
-            if(auto def = name_map.find_decl(*ref)) {
-                auto loc = convert_loc(def->id.loc);
-                log::info("[LSP] >>> return TextDocument Definition {}:{}:{}", loc.uri.path(), loc.range.start.line + 1, loc.range.start.character + 1);
-                return { loc };
-            }
-            return nullptr;
+        if(auto occurrence = names.find_at(cursor); occurrence && !occurrence->is_decl) {
+            // the flat map has the declaration in the files of the client, also if it was substituted from the last parsed text
+            auto loc = convert_loc(file_table_, compact_loc(*this, names.path(names.decl_file(occurrence->decl)), names.decl_span(occurrence->decl)));
+            log::info("[LSP] >>> return TextDocument Definition {}:{}:{}", loc.uri.path(), loc.range.start.line + 1, loc.range.start.character + 1);
+            return { loc };
         }
         // When on a declaration try find references
         if(auto occurences = find_occurrences_of_identifier(*this, cursor, false)){
             log::info("[LSP] >>> Found {} occurrences of identifier", occurences->all_occurences.size());
-            if(occurences->all_occurences.empty()) return { occurences->declaration_range };
-            return occurences->all_occurences;
+            if(occurences->all_occurences.empty()) return { convert_loc(file_table_, occurences->declaration_range) };
+            return to_locations(file_table_, occurences->all_occurences);
         }
 
 
@@ -551,11 +697,13 @@ void Server::setup_events_definitions() {
         Timer _("TextDocument_References");
         log::info("\n[LSP] <<< TextDocument References {}:{}:{}", params.textDocument.uri.path(), params.position.line + 1, params.position.character + 1);
 
-        auto cursor = convert_loc(params.textDocument, params.position);
+        // the cursor is converted with the line index of the compile that finds the occurrences
+        ensure_compile(params.textDocument.uri.path(), true);
+        auto cursor = convert_loc(*this, params.textDocument, params.position);
         auto occurences = find_occurrences_of_identifier(*this, cursor, true);
         if(!occurences) return {};
         log::info("[LSP] >>> Found {} occurrences of identifier", occurences->all_occurences.size());
-        return occurences->all_occurences;
+        return to_locations(file_table_, occurences->all_occurences);
     });
 
     message_handler_.add<reqst::TextDocument_PrepareRename>([this](lsp::TextDocumentPositionParams&& params) -> reqst::TextDocument_PrepareRename::Result {
@@ -563,7 +711,8 @@ void Server::setup_events_definitions() {
         log::info("\n[LSP] <<< TextDocument PrepareRename {}:{}:{}", 
                 params.textDocument.uri.path(), params.position.line + 1, params.position.character + 1);
 
-        auto cursor = convert_loc(params.textDocument, params.position);
+        ensure_compile(params.textDocument.uri.path(), true);
+        auto cursor = convert_loc(*this, params.textDocument, params.position);
         auto occurences = find_occurrences_of_identifier(*this, cursor, true);
         if(!occurences) {
             log::info("[LSP] >>> PrepareRename found no symbol at cursor");
@@ -573,7 +722,7 @@ void Server::setup_events_definitions() {
         // Success: return the range of the symbol to be renamed
         log::info("[LSP] >>> PrepareRename successful for symbol '{}'", occurences->name);
         auto res = lsp::PrepareRenameResult_Range_Placeholder {
-            .range = occurences->cursor_range.range,
+            .range = convert_range(occurences->cursor_range),
             .placeholder = occurences->name
         };
         return lsp::PrepareRenameResult(res);
@@ -584,7 +733,8 @@ void Server::setup_events_definitions() {
         log::info("\n[LSP] <<< TextDocument Rename {}:{}:{} -> '{}'", 
                  params.textDocument.uri.path(), params.position.line + 1, params.position.character + 1, params.newName);
 
-        auto cursor = convert_loc(params.textDocument, params.position);
+        ensure_compile(params.textDocument.uri.path(), true);
+        auto cursor = convert_loc(*this, params.textDocument, params.position);
         auto occurences = find_occurrences_of_identifier(*this, cursor, true);
         if(!occurences) {
             log::info("[LSP] >>> Rename found no symbol at cursor");
@@ -596,9 +746,9 @@ void Server::setup_events_definitions() {
         auto& changes = workspace_edit.changes.emplace();
         size_t total_edits = 0;
         for (auto& loc : occurences->all_occurences) {
-            changes[loc.uri].emplace_back(
+            changes[file_table_.uri(loc.file)].emplace_back(
                 lsp::TextEdit {
-                    .range = loc.range,
+                    .range = convert_range(loc),
                     .newText = params.newName
                 }
             );
@@ -644,15 +794,18 @@ std::string get_completion_detail(const ast::NamedDecl* decl) {
 }
 
 lsp::CompletionItemKind get_completion_kind(const ast::NamedDecl* decl) {
-    if (decl->isa<ast::FnDecl>()) return lsp::CompletionItemKind::Function;
-    if (decl->isa<ast::StaticDecl>()) return lsp::CompletionItemKind::Variable;
-    if (decl->isa<ast::PtrnDecl>()) return lsp::CompletionItemKind::Variable;
-    if (decl->isa<ast::StructDecl>()) return lsp::CompletionItemKind::Struct;
-    if (decl->isa<ast::EnumDecl>()) return lsp::CompletionItemKind::Enum;
-    if (decl->isa<ast::TypeDecl>()) return lsp::CompletionItemKind::TypeParameter;
-    if (decl->isa<ast::FieldDecl>()) return lsp::CompletionItemKind::Field;
-    if (decl->isa<ast::ModDecl>()) return lsp::CompletionItemKind::Module;
-    return lsp::CompletionItemKind::Text;
+    static constexpr lsp::CompletionItemKind kinds[] = {
+        lsp::CompletionItemKind::Function,
+        lsp::CompletionItemKind::Variable,
+        lsp::CompletionItemKind::Variable,
+        lsp::CompletionItemKind::Struct,
+        lsp::CompletionItemKind::Enum,
+        lsp::CompletionItemKind::TypeParameter,
+        lsp::CompletionItemKind::Field,
+        lsp::CompletionItemKind::Module,
+        lsp::CompletionItemKind::Text,
+    };
+    return kinds[classify<ast::FnDecl, ast::StaticDecl, ast::PtrnDecl, ast::StructDecl, ast::EnumDecl, ast::TypeDecl, ast::FieldDecl, ast::ModDecl>(*decl)];
 }
 
 bool same_file(const Loc& a, const Loc& b) { return a.file && b.file && *a.file == *b.file; }
@@ -809,13 +962,18 @@ std::optional<lsp::CompletionItem> completion_item(const ast::NamedDecl& decl) {
     return item;
 }
 
+bool is_type_decl(const ast::NamedDecl& decl) {
+    return decl.isa<ast::CtorDecl>() || decl.isa<ast::ModDecl>() || decl.isa<ast::TypeParam>() || decl.isa<ast::TypeDecl>() || decl.isa<ast::UseDecl>();
+}
+
 void Server::setup_events_completion() {
     message_handler_.add<reqst::TextDocument_Completion>([this](lsp::CompletionParams&& params) -> reqst::TextDocument_Completion::Result {
+        Timer _("TextDocument_Completion");
         log::info("[LSP] <<< TextDocument Completion {}:{}:{}", params.textDocument.uri.path(), params.position.line + 1, params.position.character + 1);
         if(get_file_type(params.textDocument.uri.path()) != FileType::SourceFile) return nullptr;
         ensure_compile(params.textDocument.uri.path());
         // params.position.character--;
-        Loc cursor = convert_loc(params.textDocument, params.position);
+        Loc cursor = convert_loc(*this, params.textDocument, params.position);
         // const ast::ProjExpr* proj_expr = nullptr;
         // const ast::PathExpr* path_expr = nullptr;
         const ast::ModDecl* current_module = compile->program.get();
@@ -827,46 +985,42 @@ void Server::setup_events_completion() {
         bool top_level = false;
         static constexpr bool debug_print = false;
 
-        auto is_type_decl = [](const ast::NamedDecl& decl) -> bool {
-            return decl.isa<ast::CtorDecl>() || decl.isa<ast::ModDecl>() || decl.isa<ast::TypeParam>() || decl.isa<ast::TypeDecl>() || decl.isa<ast::UseDecl>();
-        };
-
         lsp::CompletionList result{
             .isIncomplete = false,
             .items = {},
             .itemDefaults = lsp::CompletionListItemDefaults{ .insertTextFormat = lsp::InsertTextFormat::Snippet },
         };
 
-        ast::Node::TraverseFn traverse([&](const ast::Node& node) -> bool {
-            if(!node.loc.file) return true; // super module
-            if(!same_file(cursor, node.loc)) return false;
+        walk_at(compile->flat_tree(), *compile->program, cursor, [&](const ast::Node& node, size_t) -> bool {
             if constexpr (debug_print) log::info("test node at {} vs {}", node.loc, cursor);
-            if(!overlaps(cursor, node.loc)) {
-                return false;
-            } else if(!outer_node) {
-                outer_node = &node;
-            }
-            if(!only_show_types && (node.isa<ast::TypedExpr>() || node.isa<ast::TypedPtrn>() || node.isa<ast::TypeApp>())){
-                only_show_types = true;
-            } else if(const auto* mod = node.isa<ast::ModDecl>()){
-                current_module = mod;
-            } else if(const auto* fn = node.isa<ast::FnDecl>()){
-                if(fn->fn->param) local_scopes.push_back(fn->fn->param.get());
-                if(fn->type_params) local_scopes.push_back(fn->type_params.get());
-            } else if(const auto* block = node.isa<ast::BlockExpr>()){
-                local_scopes.push_back(block);
-                inside_block_expr = true;
-                top_level = false;
-            } else if(const auto* error = node.isa<ast::ErrorDecl>(); error && error->is_top_level) {
-                top_level = true;
+            if(!outer_node) outer_node = &node;
+            switch (classify<ast::TypedExpr, ast::TypedPtrn, ast::TypeApp, ast::ModDecl, ast::FnDecl, ast::BlockExpr, ast::ErrorDecl>(node)) {
+                case 0: case 1: case 2:
+                    only_show_types = true;
+                    break;
+                case 3:
+                    current_module = node.isa<ast::ModDecl>();
+                    break;
+                case 4: {
+                    const auto* fn = node.isa<ast::FnDecl>();
+                    if(fn->fn->param) local_scopes.push_back(fn->fn->param.get());
+                    if(fn->type_params) local_scopes.push_back(fn->type_params.get());
+                    break;
+                }
+                case 5:
+                    local_scopes.push_back(&node);
+                    inside_block_expr = true;
+                    top_level = false;
+                    break;
+                case 6:
+                    if(node.isa<ast::ErrorDecl>()->is_top_level) top_level = true;
+                    break;
             }
             inner_node = &node;
 
             if constexpr (debug_print) log::info("Node at {}", node.loc);
             return true;
         });
-        
-        traverse(compile->program);
         if(!current_module) {
             log::info("Error with completion: current_module is null");
             return result;
@@ -1020,32 +1174,75 @@ void Server::setup_events_completion() {
         log::info("Showing default completion");
         log::info("Only types: {}", only_show_types);
 
+        // Visible declarations, inner scopes shadow outer ones
+        ScopeTable<const ast::NamedDecl*> visible;
+
         // Top level declarations in current module
+        visible.push_scope();
         for (const auto& decl : current_module->decls) {
             if (const auto* named_decl = decl->isa<ast::NamedDecl>(); 
                 named_decl && (!only_show_types || is_type_decl(*named_decl))
             ) {
-                if(auto item = completion_item(*named_decl)) result.items.push_back(std::move(*item));
+                visible.insert(named_decl->id.name, named_decl);
             }
         }
 
         if (inside_block_expr){
             // Declarations in local scope
-            ast::Node::TraverseFn collect_local_decls([&](const ast::Node& node) -> bool {
+            auto collect_local_decls = [&](const ast::Node& node, size_t depth) -> bool {
                 // TODO this shows for definitions outside the loop `for a in ...` -> shows `a`
-                if(collect_local_decls.depth > 0 && node.isa<ast::BlockExpr>()) {
+                if(depth > 0 && node.isa<ast::BlockExpr>()) {
                     return false; // do not go into nested blocks
                 }
                 if (const auto* named_decl = node.isa<ast::NamedDecl>(); 
                     named_decl && (!only_show_types || is_type_decl(*named_decl))
                 ) {
-                    if(auto item = completion_item(*named_decl)) result.items.push_back(std::move(*item));
+                    visible.insert(named_decl->id.name, named_decl);
                 }
                 return true;
-            });
+            };
             for (const auto* scope : local_scopes) {
-                collect_local_decls(*scope);
+                visible.push_scope();
+                walk(compile->flat_tree(), *scope, collect_local_decls);
+            }
+        }
+
+        result.items.reserve(visible.size());
+        visible.for_each([&](std::string_view, const ast::NamedDecl* decl) {
+            if(auto item = completion_item(*decl)) result.items.push_back(std::move(*item));
+        });
+
+        // Library declarations pruned from this compile, from the prebuilt indexes
+        if (current_module == compile->program.get()) {
+            auto indexes = workspace().indexes_for(params.textDocument.uri.path());
+            std::unordered_set<std::string_view> offered;
+            for (const auto& index : indexes) {
+                for (const auto& decl : index->decls()) {
+                    auto name = index->string(decl.name);
+                    if (visible.lookup(name) || (only_show_types && !decl.is_type) || !offered.insert(name).second) continue;
+                    lsp::CompletionItem item{ .label = std::string(index->string(decl.label)) };
+                    if (decl.kind) item.kind = static_cast<lsp::CompletionItemKind>(decl.kind);
+                    if (auto detail = index->string(decl.detail); !detail.empty()) item.detail = std::string(detail);
+                    if (auto text = index->string(decl.insert_text); !text.empty()) item.insertText = std::string(text);
+                    result.items.push_back(std::move(item));
+                }
+            }
+
+            // Top-level names of the other pruned files, only known by name from the scan used for pruning
+            if (compile->pruned) {
+                workspace().for_each_declaration_outside(params.textDocument.uri.path(),
+                    [&](const workspace::File& file) { return bool(compile->locator.data(file.path.generic_string())); },
+                    [&](std::string_view name, bool is_type, const workspace::File& file) {
+                        if (visible.lookup(name) || (only_show_types && !is_type) || !offered.insert(name).second) return;
+                        result.items.push_back(lsp::CompletionItem{
+                            .label = std::string(name),
+                            .detail = file.path.filename().generic_string(),
+                        });
+                    });
             }
+        }
+
+        if (inside_block_expr){
 
             // Local snippets
             if(!only_show_types){
@@ -1177,43 +1374,82 @@ void Server::setup_events_completion() {
 //
 // -----------------------------------------------------------------------------
 
-void Server::compile_this_and_related_files(std::filesystem::path file, std::string* new_content) {
+void Server::compile_this_and_related_files(std::filesystem::path file, std::string* new_content, bool full) {
     file = fs::absolute(file);
     Timer _("Compile Files");
 
-    if(new_content) workspace_->set_file_content(file, std::move(*new_content));
+    if(new_content) workspace().set_file_content(file, std::move(*new_content));
+
+    respond_to_memory_pressure();
+    // Under critical memory pressure, compile as little as possible
+    bool degraded = memory_.pressure == memory::Pressure::Critical;
 
     workspace::config::ConfigLog cfg_log;
-    auto files = workspace_->collect_project_files(file, cfg_log);
+    bool prune = (prune_unreachable_files_ && !full) || degraded;
+    auto files = workspace().collect_project_files(file, cfg_log, prune);
     publish_config_diagnostics(cfg_log);
     
     if (files.empty()) {
         log::info("No input files to compile");
         return;
     }
+    // Deterministic order, so that equal input sets hash equally
+    std::sort(files.begin(), files.end(), [](const auto* a, const auto* b) { return a->path < b->path; });
     log::info("Compiling {} file(s)", files.size());
     for (const auto* f : files) {
         log::info(" - {}", f->path.generic_string());
     }
 
-    // Initialize
-    compile.emplace();
-    if(safe_mode_) {
-        compile->exclude_non_parsed_files = true;
-        log::info("Using safe mode");
-    }
-    try {
-        // Compile
-        compile->compile_files(files, file);
-    } catch(std::runtime_error e) {
-        log::info("Compilation failed with error: {}", e.what());
-        compile.reset();
-        return;
-    }
+    auto cache_key = CompileCache::key(files, prune, safe_mode_, degraded ? Phase::Bind : Phase::Summon);
+    if (auto cached = compile_cache_.find(cache_key)) {
+        log::info("Input files unchanged since a recent compile, reusing its result");
+        compile = std::move(cached);
+        compile->active_file = file;
+    } else {
+        std::optional<Phase> over_budget;
+        if ((isolate_compiles_ || safe_mode_) && !compile_survives_in_worker(files, file, prune, cache_key, over_budget)) {
+            // Keep the last good result, report the crash on the active file
+            lsp::Diagnostic diag;
+            diag.message = "The compiler crashed on the current input. Showing results of the last successful compile.";
+            diag.severity = lsp::DiagnosticSeverity::Error;
+            diag.range = lsp::Range{ lsp::Position{0, 0}, lsp::Position{0, 0} };
+            message_handler_.sendNotification<notif::TextDocument_PublishDiagnostics>(
+                notif::TextDocument_PublishDiagnostics::Params {
+                    .uri = lsp::FileUri::fromPath(file.generic_string()),
+                    .diagnostics = { diag }
+                }
+            );
+            return;
+        }
 
-    if(safe_mode_ && compile->parsed_all) {
-        safe_mode_ = false;
-        log::info("Successfully parsed all files, turning off safe mode");
+        auto make_compiler = [&](Phase last_phase) {
+            auto res = spare_compiler_ ? std::move(spare_compiler_) : std::make_shared<Compiler>();
+            res->pruned = prune;
+            res->last_phase = last_phase;
+            res->exclude_non_parsed_files = safe_mode_;
+            return res;
+        };
+        if(safe_mode_) log::info("Using safe mode");
+        auto heap_before = memory::heap_allocated_bytes();
+        try {
+            // Compile
+            compile = make_compiler(degraded ? Phase::Bind : Phase::Summon);
+            compile->parse_and_bind(files, file);
+            check_within_budget(*compile, over_budget);
+        } catch(std::runtime_error e) {
+            log::info("Compilation failed with error: {}", e.what());
+            compile.reset();
+            return;
+        }
+        auto heap_after = memory::heap_allocated_bytes();
+        mark_startup("first compile");
+        compile_cache_.insert(cache_key, compile, heap_after > heap_before ? heap_after - heap_before : 0);
+        enforce_memory_budget();
+
+        if(safe_mode_ && compile->parsed_all) {
+            safe_mode_ = false;
+            log::info("Successfully parsed all files, turning off safe mode");
+        }
     }
 
     const bool print_compile_log = false;
@@ -1225,12 +1461,12 @@ void Server::compile_this_and_related_files(std::filesystem::path file, std::str
         log::info("Compile failed");
     }
 
-    auto convert_diagnostic = [](const Diagnostic& diag) -> lsp::Diagnostic {
+    auto convert_diagnostic = [this](const Diagnostic& diag) -> lsp::Diagnostic {
         lsp::Diagnostic lsp_diag;
         lsp_diag.message = diag.message;
         lsp_diag.range = lsp::Range {
-            .start = lsp::Position { static_cast<lsp::uint>(diag.loc.begin.row - 1), static_cast<lsp::uint>(diag.loc.begin.col - 1) },
-            .end   = lsp::Position { static_cast<lsp::uint>(diag.loc.end.row   - 1), static_cast<lsp::uint>(diag.loc.end.col   - 1) }
+            .start = to_position(*diag.loc.file, diag.loc.begin.row, diag.loc.begin.col),
+            .end   = to_position(*diag.loc.file, diag.loc.end.row,   diag.loc.end.col)
         };
         switch (diag.severity) {
             case Diagnostic::Error:   lsp_diag.severity = lsp::DiagnosticSeverity::Error;       break;
@@ -1244,7 +1480,28 @@ void Server::compile_this_and_related_files(std::filesystem::path file, std::str
     // Send Diagnostics for the provided files only
     std::unordered_map<std::string, std::vector<lsp::Diagnostic>> diagnostics_by_file;
     for (const auto& diag : compile->diagnostics) {
-        diagnostics_by_file[*diag.loc.file].push_back(convert_diagnostic(diag));
+        auto relocation = compile->relocations.find(*diag.loc.file);
+        if (relocation == compile->relocations.end()) {
+            diagnostics_by_file[*diag.loc.file].push_back(convert_diagnostic(diag));
+            continue;
+        }
+        // in a declaration substituted from the last parsed text, shown where its rows are unchanged
+        auto begin_row = relocation->second.row(diag.loc.begin.row), end_row = relocation->second.row(diag.loc.end.row);
+        if (!begin_row || !end_row) continue;
+        auto moved = diag;
+        moved.loc.file = std::make_shared<std::string>(relocation->second.file);
+        moved.loc.begin.row = static_cast<int>(*begin_row);
+        moved.loc.end.row = static_cast<int>(*end_row);
+        diagnostics_by_file[relocation->second.file].push_back(convert_diagnostic(moved));
+    }
+    if (compile->over_budget != Phase::Done) {
+        // artic checks the whole program at once, the slow declaration is unknown
+        lsp::Diagnostic diag;
+        diag.message = "Compile budget exceeded: " + std::string(phase_name(compile->over_budget)) + " took longer than "
+            + std::to_string(compile_budget_.count()) + " ms. Showing results of " + std::string(phase_name(compile->last_phase)) + " and earlier phases only.";
+        diag.severity = lsp::DiagnosticSeverity::Information;
+        diag.range = lsp::Range{ lsp::Position{0, 0}, lsp::Position{0, 0} };
+        diagnostics_by_file[file.generic_string()].push_back(std::move(diag));
     }
     for (const auto* file : files) {
         auto path = file->path.generic_string();
@@ -1255,15 +1512,203 @@ void Server::compile_this_and_related_files(std::filesystem::path file, std::str
                 .diagnostics = diagnostics_by_file.contains(path) ? diagnostics_by_file.at(path) : std::vector<lsp::Diagnostic>{}
             }
         );
+        if (diagnostics_by_file.contains(path)) files_with_diagnostics_.insert(path);
+        else files_with_diagnostics_.erase(path);
+    }
+    // Diagnostics of files pruned from this compile were not checked again: clear them rather than show stale ones
+    if (compile->pruned) {
+        workspace().for_each_file_outside(file,
+            [&](const workspace::File& other) { return bool(compile->locator.data(other.path.generic_string())); },
+            [&](const workspace::File& other) {
+                auto path = other.path.generic_string();
+                if (!files_with_diagnostics_.erase(path)) return;
+                message_handler_.sendNotification<notif::TextDocument_PublishDiagnostics>(
+                    notif::TextDocument_PublishDiagnostics::Params { .uri = lsp::FileUri::fromPath(path), .diagnostics = {} }
+                );
+            });
+    }
+    mark_startup("first diagnostics");
+}
+
+void Server::enforce_memory_budget() {
+    if (!memory_.budget) return;
+    // the current compile is in use and cannot be evicted
+    auto usage = workspace().evictable_text_bytes() + compile_cache_.bytes(compile.get());
+    if (usage <= memory_.budget) return;
+    auto excess = usage - memory_.budget;
+    log::info("Memory budget exceeded by {} bytes, evicting", excess);
+
+    // Closed file texts first: they are cheap to restore from disk
+    auto [text_bytes, texts] = workspace().evict_closed_texts(excess);
+    excess -= std::min(excess, text_bytes);
+    auto [compile_bytes, compiles] = excess ? compile_cache_.evict(excess, compile.get()) : std::pair<size_t, size_t>{};
+
+    memory_.evicted_texts    += texts;
+    memory_.evicted_compiles += compiles;
+    memory_.evicted_bytes    += text_bytes + compile_bytes;
+    memory::trim_heap();
+}
+
+void Server::respond_to_memory_pressure() {
+    // while the pressure lasts, the caches are shed again at most this often: every compile right after
+    // shedding reads the texts back from disk without lowering the peak
+    constexpr auto shed_interval = std::chrono::seconds(30);
+    auto pressure = memory::memory_pressure();
+    auto previous = memory_.pressure;
+    if (pressure != previous) {
+        log::info("Memory pressure changed to {}", static_cast<int>(pressure));
+        if (pressure == memory::Pressure::Critical)
+            send_message("System is low on memory: Artic language server only resolves names until memory is available again", lsp::MessageType::Warning);
     }
+    memory_.pressure = pressure;
+    if (pressure == memory::Pressure::None) return;
+
+    auto now = std::chrono::steady_clock::now();
+    bool rose = pressure > previous;
+    if (rose) ++memory_.pressure_events;
+    if (!rose && now - memory_.shed_at < shed_interval) return;
+    memory_.shed_at = now;
+
+    // Drop everything that can be restored
+    auto [text_bytes, texts] = workspace().evict_closed_texts(std::numeric_limits<size_t>::max());
+    auto [compile_bytes, compiles] = compile_cache_.evict(std::numeric_limits<size_t>::max(), compile.get());
+    memory_.evicted_texts    += texts;
+    memory_.evicted_compiles += compiles;
+    memory_.evicted_bytes    += text_bytes + compile_bytes;
+    memory::trim_heap();
+}
+
+// Compile in a worker process, where the only effect is a crash or the phase reached when it is killed
+static void compile_in_worker(std::span<workspace::File*> files, const fs::path& active_file, bool prune, bool exclude_non_parsed_files, Phase last_phase, std::atomic<uint64_t>& progress) {
+    Compiler worker;
+    worker.pruned = prune;
+    worker.last_phase = last_phase;
+    worker.exclude_non_parsed_files = exclude_non_parsed_files;
+    worker.phase_progress = &progress;
+    worker.compile_files(files, active_file);
 }
 
-void Server::ensure_compile(std::string_view file_view) {
+// Requests to the worker host carry all compile inputs: a sequence of sized strings, first the options and
+// the active file, then per file its path, whether it has a text, a last parsed text and is open, and the texts
+static void put(std::string& request, std::string_view bytes) {
+    uint64_t size = bytes.size();
+    request.append(reinterpret_cast<const char*>(&size), sizeof(size));
+    request.append(bytes);
+}
+
+static std::string_view get(std::string_view& request) {
+    uint64_t size = 0;
+    std::memcpy(&size, request.data(), sizeof(size));
+    auto bytes = request.substr(sizeof(size), size);
+    request.remove_prefix(sizeof(size) + bytes.size());
+    return bytes;
+}
+
+static std::string worker_request(std::span<workspace::File*> files, const fs::path& active_file, bool prune, bool exclude_non_parsed_files, Phase last_phase) {
+    std::string request;
+    put(request, std::string{ char(prune), char(exclude_non_parsed_files), char(last_phase) });
+    put(request, active_file.generic_string());
+    for (const auto* file : files) {
+        put(request, file->path.generic_string());
+        put(request, std::string{ char(file->text.has_value()), char(file->last_parsed_text.has_value()), char(file->is_open) });
+        put(request, file->text ? std::string_view(*file->text) : std::string_view());
+        put(request, file->last_parsed_text ? std::string_view(*file->last_parsed_text) : std::string_view());
+    }
+    return request;
+}
+
+void Server::compile_worker_request(std::string_view request, std::atomic<uint64_t>& progress) {
+    auto options = get(request);
+    fs::path active_file(get(request));
+    std::vector<std::unique_ptr<workspace::File>> files;
+    while (!request.empty()) {
+        auto& file = files.emplace_back(std::make_unique<workspace::File>(fs::path(get(request))));
+        auto flags = get(request);
+        auto text = get(request), last_parsed_text = get(request);
+        if (flags[0]) file->text = std::string(text);
+        if (flags[1]) file->last_parsed_text = std::string(last_parsed_text);
+        file->is_open = flags[2];
+    }
+    std::vector<workspace::File*> inputs;
+    for (auto& file : files) inputs.push_back(file.get());
+    compile_in_worker(inputs, active_file, options[0], options[1], static_cast<Phase>(options[2]), progress);
+}
+
+bool Server::compile_survives_in_worker(std::span<workspace::File*> files, const fs::path& active_file, bool prune, uint64_t key, std::optional<Phase>& over_budget) {
+    if (crashing_inputs_.contains(key)) {
+        log::info("Input set crashed the compiler before, skipping compile");
+        return false;
+    }
+    // The result cannot leave the worker and is compiled again in the server: only test each input set once
+    if (surviving_inputs_.contains(key)) {
+        over_budget = Phase::Done;
+        return true;
+    }
+    Timer _("Compile in worker");
+    auto last_phase = memory_.pressure == memory::Pressure::Critical ? Phase::Bind : Phase::Summon;
+    // forked by the worker host (see main), which is single threaded, or by the server if there is no host
+    auto result = crash::run_in_worker_host(worker_request(files, active_file, prune, safe_mode_, last_phase), budget_expired());
+    if (!result.isolated) {
+        result = crash::run_isolated([&](std::atomic<uint64_t>& progress) {
+            compile_in_worker(files, active_file, prune, safe_mode_, last_phase, progress);
+        }, budget_expired());
+    }
+    if (!result.isolated) {
+        // no host and e.g. the workspace loading: compile unprotected rather than risk a hung worker
+        log::info("Cannot compile in a worker process{}, compiling without it", result.threads_running ? " while other threads are running" : "");
+        if (!isolation_unavailable_reported_) {
+            isolation_unavailable_reported_ = true;
+            send_message(result.threads_running
+                ? "Artic language server cannot compile in a worker process while other threads are running: compiler crashes are not isolated"
+                : "Artic language server cannot compile in a worker process on this system: compiler crashes are not isolated",
+                lsp::MessageType::Warning);
+        }
+        return true;
+    }
+    if (result.crashed) {
+        log::info("Compile worker crashed with signal {}", result.signal);
+        crashing_inputs_.insert(key);
+        return false;
+    }
+    // A worker killed over budget did not crash up to then, the server skips the phases it did not finish
+    over_budget = result.timed_out ? static_cast<Phase>(result.progress) : Phase::Done;
+    if (result.timed_out)
+        log::info("{} exceeded the compile budget of {} ms, worker killed", phase_name(*over_budget), compile_budget_.count());
+    else
+        surviving_inputs_.insert(key);
+    return true;
+}
+
+std::function<bool(uint64_t progress)> Server::budget_expired() const {
+    using clock = std::chrono::steady_clock;
+    // phase changes are noticed when polling, up to 10 ms late
+    return [budget = compile_budget_, phase = uint64_t(0), started = clock::now()](uint64_t progress) mutable {
+        if (progress != phase) {
+            phase = progress;
+            started = clock::now();
+        }
+        // parsing and binding are not budgeted, the server needs their results
+        return budget.count() > 0 && phase >= static_cast<uint64_t>(Phase::Check) && phase < static_cast<uint64_t>(Phase::Done)
+            && clock::now() - started > budget;
+    };
+}
+
+void Server::check_within_budget(Compiler& compile, std::optional<Phase> over_budget) {
+    if (over_budget && *over_budget != Phase::Done && compile.last_phase >= *over_budget) {
+        // the isolated worker was killed in that phase, do not run into it again
+        compile.last_phase = static_cast<Phase>(static_cast<uint8_t>(*over_budget) - 1);
+        compile.over_budget = *over_budget;
+    }
+    compile.phase_budget = compile_budget_;
+    compile.check();
+}
+
+void Server::ensure_compile(std::string_view file_view, bool full) {
     fs::path file = absolute_path(file_view);
     if(get_file_type(file) != FileType::SourceFile) {
         throw lsp::RequestError(lsp::Error::InvalidParams, "File is not an Artic source file");
     }
-    bool already_compiled = compile && compile->locator.data(file.generic_string());
+    bool already_compiled = compile && compile->locator.data(file.generic_string()) && !(full && compile->pruned);
     // if(compile){
     //     log::info("Already compiled files:");
     //     for(auto& [path, _] : compile->locator.info) {
@@ -1272,7 +1717,7 @@ void Server::ensure_compile(std::string_view file_view) {
     // }
     // log::info("is {} already compiled: {}", file.generic_string(), already_compiled);
 
-    if (!already_compiled) compile_this_and_related_files(file);
+    if (!already_compiled) compile_this_and_related_files(file, nullptr, full);
     if (!compile) throw lsp::RequestError(lsp::Error::ServerCancelled, "Did not get a compilation result");
 }
 
@@ -1393,7 +1838,8 @@ void Server::reload_workspace(const std::string& active_file) {
     Timer _("Reload Workspace");
     log::info("Reloading workspace configuration");
     workspace::config::ConfigLog log;
-    workspace_->reload(log);
+    workspace().reload(log);
+    compile_cache_.clear();
     publish_config_diagnostics(log);
     
     // Recompile last compile
@@ -1418,6 +1864,13 @@ namespace artic::reqst {
         using Params = lsp::TextDocumentPositionParams;
         using Result = lsp::Nullable<std::string>;
     };
+    // Server statistics as a JSON string
+    struct Stats {
+        static constexpr auto Method = std::string_view("artic/stats");
+        static constexpr auto Direction = lsp::MessageDirection::ClientToServer;
+        static constexpr auto Type = lsp::Message::Request;
+        using Result = std::string;
+    };
 }
 
 void Server::setup_events_other() {
@@ -1435,23 +1888,22 @@ void Server::setup_events_other() {
             throw lsp::RequestError(lsp::Error::InternalError, "No compilation result available");
         }
 
-        Loc cursor = convert_loc(params.textDocument, params.position);
+        Loc cursor = convert_loc(*this, params.textDocument, params.position);
         const ast::Node* inner_node = nullptr;
         const ast::Node* outer_node = nullptr;
 
         // Find the AST node at the cursor position
-        ast::Node::TraverseFn traverse([&](const ast::Node& node) -> bool {
-            if (node.loc.file && same_file(node.loc, cursor) && overlaps(node.loc, cursor)) {
+        walk(compile->flat_tree(), *compile->program, [&](const ast::Node& node, size_t) -> bool {
+            if (!node.loc.file) return true; // super module
+            if (same_file(node.loc, cursor) && overlaps(node.loc, cursor)) {
                 if(!outer_node) {
                     outer_node = &node;
                 }
                 inner_node = &node;
                 return true; // Continue to find the most specific node
             }
-            return true;
+            return false; // children lie within their parent
         });
-        
-        traverse(compile->program);
 
         if (!outer_node || !inner_node) {
             return nullptr;
@@ -1472,6 +1924,61 @@ void Server::setup_events_other() {
         return buffer.str();
     });
 
+    message_handler_.add<artic::reqst::Stats>([this]() -> artic::reqst::Stats::Result {
+        log::info("\n[LSP] <<< artic/stats");
+        nlohmann::json stats;
+        stats["memory"] = {
+            {"budget",              memory_.budget},
+            {"residentBytes",       memory::resident_bytes()},
+            {"heapAllocatedBytes",  memory::heap_allocated_bytes()},
+            {"fileTextBytes",       workspace_ ? workspace().evictable_text_bytes() : 0},
+            {"compileCacheBytes",   compile_cache_.bytes(compile.get())},
+            {"compileCacheEntries", compile_cache_.size()},
+            {"evictedTexts",        memory_.evicted_texts},
+            {"evictedCompiles",     memory_.evicted_compiles},
+            {"evictedBytes",        memory_.evicted_bytes},
+            {"pressure",            static_cast<int>(memory_.pressure)},
+            {"pressureEvents",      memory_.pressure_events},
+        };
+        // fragmentation and allocations only where the allocator reports them
+        auto heap = memory::allocator_stats();
+        auto now = std::chrono::steady_clock::now();
+        auto seconds = std::chrono::duration<double>(now - memory_.sampled_at).count();
+        stats["allocator"] = {
+            {"name",           std::string(memory::allocator_name())},
+            {"allocatedBytes", heap.allocated},
+            {"heldBytes",      heap.held},
+            {"fragmentation",  heap.fragmentation() >= 0 ? nlohmann::json(heap.fragmentation()) : nlohmann::json()},
+            {"allocations",    heap.allocations ? nlohmann::json(heap.allocations) : nlohmann::json()},
+            // since the previous stats request
+            {"allocationsPerSecond", heap.allocations && seconds > 0
+                ? nlohmann::json(double(heap.allocations - memory_.sampled_allocations) / seconds) : nlohmann::json()},
+        };
+        memory_.sampled_allocations = heap.allocations;
+        memory_.sampled_at = now;
+        // per LSP request (Timer) and compile phase, allocations only when built with ARTIC_LS_COUNT_ALLOCATIONS
+        stats["latency"] = nlohmann::json::object();
+        for (const auto& summary : ls::stats::summaries()) {
+            auto& entry = stats["latency"][summary.name] = {
+                {"count",   summary.count},
+                {"totalMs", summary.total_ms},
+                {"p50Ms",   summary.p50_ms},
+                {"p99Ms",   summary.p99_ms},
+                {"maxMs",   summary.max_ms},
+            };
+            if (ls::stats::counting_allocations()) {
+                entry["allocations"]         = summary.allocations.count;
+                entry["allocatedBytes"]      = summary.allocations.bytes;
+                entry["frees"]               = summary.allocations.frees;
+                entry["allocationsPerCall"]  = double(summary.allocations.count) / double(summary.count);
+            }
+        }
+        // milliseconds since process start
+        stats["startup"] = nlohmann::json::object();
+        for (const auto& [stage, ms] : startup_stages_) stats["startup"][stage] = ms;
+        return stats.dump();
+    });
+
     message_handler_.add<reqst::TextDocument_InlayHint>([this](reqst::TextDocument_InlayHint::Params&& params) -> reqst::TextDocument_InlayHint::Result {
         Timer _("TextDocument_InlayHint");
         fs::path file = absolute_path(params.textDocument.uri.path());
@@ -1497,10 +2004,7 @@ void Server::setup_events_other() {
                 continue;
             }
 
-            lsp::Position hint_pos{
-                static_cast<lsp::uint>(loc.end.row - 1),
-                static_cast<lsp::uint>(hint->loc.end.col - 1)
-            };
+            lsp::Position hint_pos = to_position(*loc.file, loc.end.row, loc.end.col);
 
             // Check if the hint position is within the requested range
             if (hint_pos.line < params.range.start.line || 
@@ -1532,7 +2036,6 @@ void Server::setup_events_other() {
         return hints;
     });
 
-    // notif::Workspace_DidChangeWorkspaceFolders
     // notif::Workspace_DidCreateFiles
     // notif::Workspace_DidDeleteFiles
     // notif::Workspace_DidRenameFiles
@@ -0,0 +1,164 @@
+#include "stats.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <new>
+
+namespace artic::ls::stats {
+
+namespace {
+
+// Counters of the calling thread, trivially initialized so that operator new needs no TLS guard
+thread_local uint64_t allocation_count = 0;
+thread_local uint64_t allocation_bytes = 0;
+thread_local uint64_t free_count = 0;
+
+struct Entry {
+    uint64_t count = 0;
+    double total_ms = 0, max_ms = 0;
+    Allocations allocations;
+    // ring buffer of the latest latencies, for the percentiles
+    std::vector<double> recent;
+    size_t next = 0;
+};
+constexpr size_t max_recent = 1024;
+
+std::mutex mutex;
+std::map<std::string, Entry, std::less<>> entries;
+
+} // anonymous namespace
+
+bool counting_allocations() {
+#if defined(ARTIC_LS_COUNT_ALLOCATIONS)
+    return true;
+#else
+    return false;
+#endif
+}
+
+Allocations thread_allocations() {
+    return { allocation_count, allocation_bytes, free_count };
+}
+
+void record(std::string_view name, double ms, const Allocations& allocations) {
+    std::lock_guard lock(mutex);
+    auto it = entries.find(name);
+    if (it == entries.end()) it = entries.emplace(std::string(name), Entry{}).first;
+    auto& entry = it->second;
+    ++entry.count;
+    entry.total_ms += ms;
+    entry.max_ms = std::max(entry.max_ms, ms);
+    entry.allocations += allocations;
+    if (entry.recent.size() < max_recent) {
+        entry.recent.push_back(ms);
+    } else {
+        entry.recent[entry.next] = ms;
+        entry.next = (entry.next + 1) % max_recent;
+    }
+}
+
+std::vector<Summary> summaries() {
+    std::lock_guard lock(mutex);
+    std::vector<Summary> res;
+    res.reserve(entries.size());
+    for (const auto& [name, entry] : entries) {
+        auto recent = entry.recent;
+        std::sort(recent.begin(), recent.end());
+        auto percentile = [&](double p) { return recent.empty() ? 0.0 : recent[std::min(recent.size() - 1, size_t(p * recent.size()))]; };
+        res.push_back({
+            .name = name,
+            .count = entry.count,
+            .total_ms = entry.total_ms,
+            .max_ms = entry.max_ms,
+            .p50_ms = percentile(0.5),
+            .p99_ms = percentile(0.99),
+            .allocations = entry.allocations,
+        });
+    }
+    return res;
+}
+
+} // namespace artic::ls::stats
+
+#if defined(ARTIC_LS_COUNT_ALLOCATIONS)
+
+// Counting replacements of the global operator new and delete -----------------
+// Linked into every target using the library, since Timer references this file.
+
+namespace {
+
+void* counted_alloc(std::size_t size, std::size_t alignment = 0) {
+    using namespace artic::ls::stats;
+    ++allocation_count;
+    allocation_bytes += size;
+    if (size == 0) size = 1;
+    while (true) {
+        void* p;
+        if (alignment == 0) {
+            p = std::malloc(size);
+        } else {
+#if defined(_WIN32)
+            p = _aligned_malloc(size, alignment);
+#else
+            p = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+#endif
+        }
+        if (p) return p;
+        auto handler = std::get_new_handler();
+        if (!handler) return nullptr;
+        handler();
+    }
+}
+
+void counted_free(void* p, std::size_t alignment = 0) noexcept {
+    if (!p) return;
+    ++artic::ls::stats::free_count;
+#if defined(_WIN32)
+    if (alignment) return _aligned_free(p);
+#else
+    (void)alignment;
+#endif
+    std::free(p);
+}
+
+void* throwing_alloc(std::size_t size, std::size_t alignment = 0) {
+    if (auto p = counted_alloc(size, alignment)) return p;
+    throw std::bad_alloc();
+}
+
+// The new handler reports failure by throwing bad_alloc, which must not leave the nothrow versions
+void* nothrow_alloc(std::size_t size, std::size_t alignment = 0) noexcept {
+    try {
+        return counted_alloc(size, alignment);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+} // anonymous namespace
+
+void* operator new(std::size_t size)                                        { return throwing_alloc(size); }
+void* operator new[](std::size_t size)                                      { return throwing_alloc(size); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept        { return nothrow_alloc(size); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept      { return nothrow_alloc(size); }
+void* operator new(std::size_t size, std::align_val_t al)                   { return throwing_alloc(size, std::size_t(al)); }
+void* operator new[](std::size_t size, std::align_val_t al)                 { return throwing_alloc(size, std::size_t(al)); }
+void* operator new(std::size_t size, std::align_val_t al, const std::nothrow_t&) noexcept   { return nothrow_alloc(size, std::size_t(al)); }
+void* operator new[](std::size_t size, std::align_val_t al, const std::nothrow_t&) noexcept { return nothrow_alloc(size, std::size_t(al)); }
+
+void operator delete(void* p) noexcept                                      { counted_free(p); }
+void operator delete[](void* p) noexcept                                    { counted_free(p); }
+void operator delete(void* p, std::size_t) noexcept                         { counted_free(p); }
+void operator delete[](void* p, std::size_t) noexcept                       { counted_free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept               { counted_free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept             { counted_free(p); }
+void operator delete(void* p, std::align_val_t al) noexcept                 { counted_free(p, std::size_t(al)); }
+void operator delete[](void* p, std::align_val_t al) noexcept               { counted_free(p, std::size_t(al)); }
+void operator delete(void* p, std::size_t, std::align_val_t al) noexcept    { counted_free(p, std::size_t(al)); }
+void operator delete[](void* p, std::size_t, std::align_val_t al) noexcept  { counted_free(p, std::size_t(al)); }
+void operator delete(void* p, std::align_val_t al, const std::nothrow_t&) noexcept   { counted_free(p, std::size_t(al)); }
+void operator delete[](void* p, std::align_val_t al, const std::nothrow_t&) noexcept { counted_free(p, std::size_t(al)); }
+
+#endif
@@ -8,9 +8,11 @@
 #include <algorithm>
 #include <fstream>
 #include <filesystem>
+#include <atomic>
 #include <iostream>
 #include <memory>
 #include <optional>
+#include <thread>
 #include <vector>
 #include <unordered_set>
 
@@ -57,12 +59,140 @@ void File::read() {
 
 // Workspace --------------------------------------------------------------------
 
+// A config parsed (and its file patterns expanded) independently of the workspace state,
+// so that several configs can be parsed concurrently
+struct Workspace::ParsedConfig {
+    explicit ParsedConfig(const ConfigPath& origin)
+        : parser(origin, log), success(parser.parse())
+    {}
+
+    config::ConfigLog log;
+    config::ConfigParser parser;
+    bool success;
+};
+
+Workspace::Workspace(std::vector<fs::path> folders)
+    : folders_(std::move(folders)), arena_(std::make_unique<Arena>())
+{}
+
+Workspace::~Workspace() = default;
+
 void Workspace::reload(config::ConfigLog& log) {
+    // texts of open files are owned by the client and cannot be re-read from disk
+    std::vector<std::pair<fs::path, std::optional<std::string>>> open_files;
+    for (auto& [path, file] : files_) {
+        if (file->is_open) open_files.emplace_back(path, std::move(file->text));
+    }
+
+    project_for_file_cache_.clear();
+    modules_.clear();
+    name_indexes_.clear();
+    symbols_.clear();
+    indexed_files_.clear();
+    symbol_table_.clear();
+    compact_symbols_at_ = min_symbols_to_compact;
     projects_.clear();
     files_.clear();
     configs_.clear();
+    prefetched_.clear();
     arena_ = std::make_unique<Arena>();
+
+    for (auto& [path, text] : open_files) {
+        auto file = tracked_file(path);
+        file->is_open = true;
+        file->text = std::move(text);
+    }
+    add_folders(folders_, log);
+}
+
+// Workspace Folders ------------------------------------------------------------
+
+void Workspace::add_folders(const std::vector<fs::path>& folders, config::ConfigLog& log) {
+    std::vector<ConfigPath> roots;
+    for (auto folder : folders) {
+        folder = fs::weakly_canonical(folder);
+        if (std::find(folders_.begin(), folders_.end(), folder) == folders_.end())
+            folders_.push_back(folder);
+
+        for (auto file_name : config_file_names) {
+            auto path = folder / file_name;
+            if (fsscan::stat_kind(path) != fsscan::Kind::File) continue;
+            roots.push_back(ConfigPath{ .path = path, .raw_path_string = path.generic_string() });
+            break;
+        }
+    }
+    log::info("Discovering configs of {} workspace folder(s)", folders.size());
+
+    prefetch_configs(roots);
+    for (const auto& root : roots)
+        instantiate_config(root, log);
+    prefetched_.clear();
+
+    // New projects may claim files that were previously resolved to another project
+    project_for_file_cache_.clear();
+    modules_.clear();
+    name_indexes_.clear();
+}
+
+void Workspace::remove_folder(fs::path folder, config::ConfigLog& log) {
+    folder = fs::weakly_canonical(folder);
+    log::info("Removing workspace folder {}", folder.generic_string());
+    std::erase(folders_, folder);
+
+    auto is_inside = [&](const fs::path& path) {
+        auto rel = path.lexically_relative(folder);
+        return !rel.empty() && *rel.begin() != "..";
+    };
     project_for_file_cache_.clear();
+    modules_.clear();
+    name_indexes_.clear();
+    // scanned and indexed symbols of files of the removed projects
+    symbols_.clear();
+    indexed_files_.clear();
+    symbol_table_.clear();
+    compact_symbols_at_ = min_symbols_to_compact;
+    ++symbols_version_;
+    std::erase_if(projects_, [&](const auto& entry) { return is_inside(entry.second->origin); });
+    std::erase_if(configs_,  [&](const auto& entry) { return is_inside(entry.first); });
+}
+
+// Parses json configs and all configs they include, one include level at a time.
+// Every level is parsed concurrently by at most one thread per core, results are picked up by instantiate_config_json.
+void Workspace::prefetch_configs(std::vector<ConfigPath> configs) {
+    std::unordered_set<fs::path> seen;
+    while (!configs.empty()) {
+        std::vector<ConfigPath> pending;
+        for (auto& origin : configs) {
+            origin.path = fs::weakly_canonical(origin.path);
+            auto ext = origin.path.extension();
+            if (ext != ".json" && ext != ".artic-lsp") continue;
+            if (configs_.contains(origin.path) || prefetched_.contains(origin.path)) continue;
+            if (!seen.insert(origin.path).second) continue;
+            pending.push_back(origin);
+        }
+
+        std::vector<std::unique_ptr<ParsedConfig>> results(pending.size());
+        std::atomic<size_t> next = 0;
+        auto jobs = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), pending.size());
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < jobs; ++i) {
+            workers.emplace_back([&] {
+                for (size_t index; (index = next++) < pending.size();)
+                    results[index] = std::make_unique<ParsedConfig>(pending[index]);
+            });
+        }
+        for (auto& worker : workers) worker.join();
+
+        configs.clear();
+        for (auto& parsed : results) {
+            if (parsed->success) {
+                const auto& includes = parsed->parser.config.includes;
+                configs.insert(configs.end(), includes.begin(), includes.end());
+            }
+            auto path = parsed->parser.origin.path;
+            prefetched_[path] = std::move(parsed);
+        }
+    }
 }
 
 ConfigFile* Workspace::instantiate_config(const ConfigPath& origin, config::ConfigLog& log) {
@@ -94,6 +224,8 @@ ConfigFile* Workspace::instantiate_config_vcxproj(const ConfigPath& origin, conf
         return nullptr;
     }
     projects_[project->name] = arena_->make_ptr<Project>(*project); // copy
+    modules_.clear();
+    name_indexes_.clear();
 
     ConfigFile cfg{
         .path = origin.path,
@@ -106,9 +238,16 @@ ConfigFile* Workspace::instantiate_config_vcxproj(const ConfigPath& origin, conf
 
 ConfigFile* Workspace::instantiate_config_json(const ConfigPath& origin, config::ConfigLog& log) {
     log::info("Instantiating config: {}", origin.path.generic_string());
-    config::ConfigParser parser(origin, log);
-    bool success = parser.parse();
-    if (!success) return nullptr;
+    std::unique_ptr<ParsedConfig> parsed;
+    if (auto it = prefetched_.find(origin.path); it != prefetched_.end()) {
+        parsed = std::move(it->second);
+        prefetched_.erase(it);
+    } else {
+        parsed = std::make_unique<ParsedConfig>(origin);
+    }
+    log.messages.insert(log.messages.end(), parsed->log.messages.begin(), parsed->log.messages.end());
+    if (!parsed->success) return nullptr;
+    auto& parser = parsed->parser;
 
     log.file_context = origin.path;
     // track config
@@ -122,6 +261,9 @@ ConfigFile* Workspace::instantiate_config_json(const ConfigPath& origin, config:
         }
         projects_[project.name] = arena_->make_ptr<Project>(project); // copy
     }
+    // new projects may resolve dependencies of existing ones
+    modules_.clear();
+    name_indexes_.clear();
     
     // recurse included configs
     for (const auto& include : parser.config.includes) {
@@ -0,0 +1,85 @@
+// Go to definition on a declaration substituted from the last parsed text of a file
+//
+//     ctest --test-dir build
+//
+// Built with -D ARTIC_LS_BUILD_TESTS=ON. The body of helper stops parsing, main is still compiled against
+// the last version of helper that parsed, and its definition must be in the edited file, where it is now.
+
+#include "compile.h"
+#include "workspace.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <string>
+
+namespace fs = std::filesystem;
+using namespace artic;
+using namespace artic::ls;
+
+namespace {
+
+int failures = 0;
+
+void expect(bool condition, const char* what) {
+    if (condition) return;
+    std::fprintf(stderr, "FAILED: %s\n", what);
+    ++failures;
+}
+
+} // anonymous namespace
+
+int main() {
+    workspace::File file(fs::path("/test/main.art"));
+    file.is_open = true;
+    workspace::File* files[] = { &file };
+    auto path = file.path.generic_string();
+
+    file.text =
+        "fn helper(x: i32) -> i32 {\n"
+        "    x\n"
+        "}\n"
+        "\n"
+        "fn main() -> i32 {\n"
+        "    helper(1)\n"
+        "}\n";
+    {
+        Compiler compiler;
+        compiler.compile_files(files, file.path);
+        expect(compiler.log.errors == 0, "the first text compiles");
+        expect(file.last_parsed_text == file.text, "the first text is kept as the last parsed one");
+    }
+
+    // the edit adds a row, so main and its call to helper move down by one
+    file.text =
+        "fn helper(x: i32) -> i32 {\n"
+        "    let y = x;\n"
+        "    y +\n"
+        "}\n"
+        "\n"
+        "fn main() -> i32 {\n"
+        "    helper(1)\n"
+        "}\n";
+    Compiler compiler;
+    compiler.compile_files(files, file.path);
+    expect(compiler.log.errors > 0, "the edited text does not parse");
+    expect(compiler.relocations.size() == 1, "helper is substituted from the last parsed text");
+
+    auto& names = compiler.flat_names();
+    for (const auto& [stand_in, _] : compiler.relocations)
+        expect(!names.file_names(stand_in), "no names are left in the file helper was compiled under");
+
+    // cursor on the call to helper in main
+    auto occurrence = names.find_at(Loc(std::make_shared<std::string>(path), Loc::Pos{ .row = 7, .col = 6 }));
+    expect(occurrence && !occurrence->is_decl, "the call to helper is a reference");
+    if (occurrence) {
+        expect(names.decl(occurrence->decl)->id.name == "helper", "the reference is to helper");
+        expect(names.path(names.decl_file(occurrence->decl)) == path, "the definition of helper is in the edited file");
+        auto span = names.decl_span(occurrence->decl);
+        expect(span.begin_row == 1 && span.begin_col == 4, "the definition of helper is at its name");
+    }
+
+    if (failures) return 1;
+    std::puts("definition: ok");
+    return 0;
+}
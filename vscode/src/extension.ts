@@ -100,7 +100,10 @@ function startClient(context: vscode.ExtensionContext) {
                 restartFromCrash = false;
 
                 return {
-                    restartFromCrash: hasCrashed
+                    restartFromCrash: hasCrashed,
+                    isolateCompiles: vscode.workspace.getConfiguration('artic').get<boolean>('isolateCompiles', false),
+                    memoryBudgetMB: vscode.workspace.getConfiguration('artic').get<number>('memoryBudgetMB', 0),
+                    compileBudgetMs: vscode.workspace.getConfiguration('artic').get<number>('compileBudgetMs', 5000)
                 };
             },
             connectionOptions: {
@@ -316,6 +319,24 @@ export function activate(context: vscode.ExtensionContext) {
         }
     });
     context.subscriptions.push(debugAstCommand);
+
+    const showStatsCommand = vscode.commands.registerCommand('artic.showStats', async () => {
+        try {
+            if (!client || !client.isRunning()) {
+                vscode.window.showWarningMessage('Artic Language Server is not running');
+                return;
+            }
+            const result = await client.sendRequest('artic/stats');
+            const statsDoc = await vscode.workspace.openTextDocument({
+                content: JSON.stringify(JSON.parse(result as string), null, 2),
+                language: 'json'
+            });
+            await vscode.window.showTextDocument(statsDoc, vscode.ViewColumn.Beside);
+        } catch (e: any) {
+            vscode.window.showErrorMessage(`Failed to get server statistics: ${e.message}`);
+        }
+    });
+    context.subscriptions.push(showStatsCommand);
 }
 
 export function deactivate(): Thenable<void> | undefined {